@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <cassert>
 #include <iterator>
+#include <unordered_map>
 #include <file.h>
 #include <disasm.h>
 #include <image.h>
+#include <image_cache.h>
 #include <xbox.h>
 #include <fmt/core.h>
 #include "function.h"
@@ -172,6 +175,254 @@ void* SearchMask(const void* source, const uint32_t* compare, size_t compareCoun
     return nullptr;
 }
 
+constexpr size_t c_minVirtualTableSize = 2;
+constexpr size_t c_maxVirtualCallTargets = 4;
+constexpr size_t c_maxVirtualCallDistance = 16;
+
+struct VirtualTable
+{
+    size_t base{};
+    std::vector<size_t> functions{};
+};
+
+struct VirtualCall
+{
+    size_t base{};
+    size_t slot{};
+    std::vector<size_t> targets{};
+};
+
+bool IsFunction(const Image& image, size_t address)
+{
+    auto symbol = image.symbols.find(address);
+    return symbol != image.symbols.end() && symbol->address == address && symbol->type == Symbol_Function;
+}
+
+bool IsCode(const Image& image, size_t address)
+{
+    if ((address & 3) != 0)
+    {
+        return false;
+    }
+
+    for (const auto& section : image.sections)
+    {
+        if ((section.flags & SectionFlags_Code) && address >= section.base && address < section.base + section.size)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Registers the functions described in .pdata and the targets of branch link instructions,
+// the same way the recompiler discovers functions before its own analysis.
+void AnalyseFunctions(Image& image)
+{
+    auto* pdata = image.Find(".pdata");
+    if (pdata != nullptr)
+    {
+        size_t count = pdata->size / sizeof(IMAGE_CE_RUNTIME_FUNCTION);
+        auto* pf = (IMAGE_CE_RUNTIME_FUNCTION*)pdata->data;
+        for (size_t i = 0; i < count; i++)
+        {
+            auto fn = pf[i];
+            fn.BeginAddress = ByteSwap(fn.BeginAddress);
+            fn.Data = ByteSwap(fn.Data);
+
+            if (image.symbols.find(fn.BeginAddress) == image.symbols.end())
+            {
+                image.symbols.emplace(fmt::format("sub_{:X}", fn.BeginAddress), fn.BeginAddress, fn.FunctionLength * 4, Symbol_Function);
+            }
+        }
+    }
+
+    for (const auto& section : image.sections)
+    {
+        if (!(section.flags & SectionFlags_Code))
+        {
+            continue;
+        }
+
+        for (size_t offset = 0; offset + 4 <= section.size; offset += 4)
+        {
+            uint32_t insn = ByteSwap(*(uint32_t*)(section.data + offset));
+            if (PPC_OP(insn) == PPC_OP_B && PPC_BL(insn))
+            {
+                size_t address = section.base + offset + PPC_BI(insn);
+                if (address >= section.base && address < section.base + section.size && image.symbols.find(address) == image.symbols.end())
+                {
+                    auto fn = Function::Analyze(section.data + address - section.base, section.base + section.size - address, address);
+                    image.symbols.emplace(fmt::format("sub_{:X}", fn.base), fn.base, fn.size, Symbol_Function);
+                }
+            }
+        }
+    }
+}
+
+// Virtual tables are runs of aligned words in data sections pointing at code.
+// Words pointing at code which isn't a known function start still occupy their slot,
+// so a table isn't split into several tables with shifted slots.
+std::vector<VirtualTable> ScanVirtualTables(const Image& image)
+{
+    std::vector<VirtualTable> tables{};
+
+    for (const auto& section : image.sections)
+    {
+        if ((section.flags & SectionFlags_Code) || section.data == nullptr)
+        {
+            continue;
+        }
+
+        const auto* words = (be<uint32_t>*)section.data;
+        size_t count = section.size / 4;
+        size_t i = 0;
+        while (i < count)
+        {
+            VirtualTable table{};
+            table.base = section.base + i * 4;
+
+            bool hasFunction = false;
+            for (; i < count && IsCode(image, words[i]); i++)
+            {
+                table.functions.push_back(words[i]);
+                hasFunction |= IsFunction(image, words[i]);
+            }
+
+            if (table.functions.empty())
+            {
+                i++;
+            }
+            else if (table.functions.size() >= c_minVirtualTableSize && hasFunction)
+            {
+                tables.emplace_back(std::move(table));
+            }
+        }
+    }
+
+    return tables;
+}
+
+bool WritesRegister(const ppc_insn& insn, uint32_t r)
+{
+    std::string_view name = insn.opcode->name;
+    auto startsWith = [&](std::string_view prefix) { return name.compare(0, prefix.size(), prefix) == 0; };
+    if (startsWith("st") || startsWith("cmp") || startsWith("mt") || startsWith("tw") || startsWith("td") || startsWith("dcb"))
+    {
+        return false;
+    }
+
+    return insn.operands[0] == r;
+}
+
+// Matches the instructions leading to an indirect call through a virtual table:
+//
+//   lwz rV, d(rX)     ; load the virtual table pointer
+//   lwz rF, slot(rV)  ; load the function pointer
+//   mtctr rF
+//   bctrl
+//
+// Other instructions may be scheduled in between, but no branches or writes to the registers involved.
+bool ScanVirtualCall(const Image& image, const uint32_t* code, size_t base, VirtualCall& call)
+{
+    enum
+    {
+        SEARCH_MTCTR,
+        SEARCH_FUNCTION,
+        SEARCH_TABLE,
+    } state = SEARCH_MTCTR;
+
+    uint32_t r{};
+    ppc_insn insn;
+    for (size_t i = 1; i <= c_maxVirtualCallDistance; i++)
+    {
+        size_t address = base - 4 * i;
+        if (!IsCode(image, address))
+        {
+            break;
+        }
+
+        ppc::Disassemble(&code[-ptrdiff_t(i)], address, insn);
+        if (insn.opcode == nullptr || insn.opcode->name[0] == 'b')
+        {
+            break;
+        }
+
+        if (state == SEARCH_MTCTR)
+        {
+            if (insn.opcode->id == PPC_INST_MTCTR)
+            {
+                r = insn.operands[0];
+                state = SEARCH_FUNCTION;
+            }
+        }
+        else if (WritesRegister(insn, r))
+        {
+            if (insn.opcode->id != PPC_INST_LWZ || insn.operands[2] == 0)
+            {
+                break;
+            }
+
+            if (state == SEARCH_FUNCTION)
+            {
+                int32_t offset = int32_t(insn.operands[1]);
+                if (offset < 0 || (offset & 3) != 0)
+                {
+                    break;
+                }
+
+                call.base = base;
+                call.slot = offset / 4;
+                r = insn.operands[2];
+                state = SEARCH_TABLE;
+            }
+            else
+            {
+                return true;
+            }
+        }
+
+        if (IsFunction(image, address))
+        {
+            break;
+        }
+    }
+
+    return false;
+}
+
+// Collects the function at the called slot of every virtual table large enough to contain it,
+// ordered from the most to the least shared one.
+bool ResolveVirtualCall(const Image& image, const std::vector<VirtualTable>& tables, VirtualCall& call)
+{
+    std::unordered_map<size_t, size_t> counts{};
+    for (const auto& table : tables)
+    {
+        if (call.slot < table.functions.size())
+        {
+            size_t target = table.functions[call.slot];
+            if (!IsFunction(image, target))
+            {
+                return false;
+            }
+
+            if (counts[target]++ == 0)
+            {
+                call.targets.push_back(target);
+            }
+        }
+    }
+
+    if (call.targets.empty() || call.targets.size() > c_maxVirtualCallTargets)
+    {
+        return false;
+    }
+
+    std::stable_sort(call.targets.begin(), call.targets.end(), [&](size_t lhs, size_t rhs) { return counts[lhs] > counts[rhs]; });
+    return true;
+}
+
 static std::string out;
 
 template<class... Args>
@@ -185,12 +436,25 @@ int main(int argc, char** argv)
 {
     if (argc < 3)
     {
-        printf("Usage: XenonAnalyse [input XEX file path] [output jump table TOML file path]");
+        printf("Usage: XenonAnalyse [input XEX file path] [output jump table TOML file path] [output indirect call TOML file path (optional)] [image cache file path (optional)]");
         return EXIT_SUCCESS;
     }
 
-    const auto file = LoadFile(argv[1]);
-    auto image = Image::ParseImage(file.data(), file.size());
+    Image image{};
+    if (argc > 4)
+    {
+        const auto imageCacheKey = ComputeImageCacheKey(argv[1]);
+        if (!LoadImageCache(argv[4], imageCacheKey, image))
+        {
+            image = Image::ParseImage(std::filesystem::path(argv[1]));
+            if (!SaveImageCache(argv[4], imageCacheKey, image))
+                fmt::println("WARNING: Unable to save the image cache");
+        }
+    }
+    else
+    {
+        image = Image::ParseImage(std::filesystem::path(argv[1]));
+    }
 
     auto printTable = [&](const SwitchTable& table)
         {
@@ -308,5 +572,56 @@ int main(int argc, char** argv)
     std::ofstream f(argv[2]);
     f.write(out.data(), out.size());
 
+    if (argc > 3 && argv[3][0] != '\0')
+    {
+        out.clear();
+        println("# Generated by XenonAnalyse");
+
+        AnalyseFunctions(image);
+        auto tables = ScanVirtualTables(image);
+
+        println("# ---- VIRTUAL CALLS ({} VIRTUAL TABLES) ----", tables.size());
+
+        for (const auto& section : image.sections)
+        {
+            if (!(section.flags & SectionFlags_Code))
+            {
+                continue;
+            }
+
+            const auto* code = (uint32_t*)section.data;
+            for (size_t i = 0; i < section.size / 4; i++)
+            {
+                size_t base = section.base + i * 4;
+
+                ppc_insn insn;
+                ppc::Disassemble(&code[i], base, insn);
+                if (insn.opcode == nullptr || (insn.opcode->id != PPC_INST_BCTRL && insn.opcode->id != PPC_INST_BCTR))
+                {
+                    continue;
+                }
+
+                VirtualCall call{};
+                if (ScanVirtualCall(image, &code[i], base, call) && ResolveVirtualCall(image, tables, call))
+                {
+                    // Never written as direct, since the scan can miss tables, like the ones of derived classes, pointing at other functions.
+                    println("[[indirect_call]]");
+                    println("address = 0x{:X}", call.base);
+                    println("targets = [");
+                    for (auto target : call.targets)
+                    {
+                        println("    0x{:X},", target);
+                    }
+
+                    println("]");
+                    println("");
+                }
+            }
+        }
+
+        std::ofstream f(argv[3]);
+        f.write(out.data(), out.size());
+    }
+
     return EXIT_SUCCESS;
 }
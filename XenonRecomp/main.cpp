@@ -42,10 +42,20 @@ int main(int argc, char* argv[])
             ;
 
         recompiler.Recompile(headerFilePath);
+        recompiler.PrintStats();
     }
     else
     {
-        TestRecompiler::RecompileTests(path, argv[2]);
+        // The CR fields can be packed and the integer operations narrowed to test the recompiled code of every mode.
+        bool packedCrRegisters = false;
+        bool narrowIntegerOperations = false;
+        for (int i = 3; i < argc; i++)
+        {
+            packedCrRegisters |= strcmp(argv[i], "--packed-cr") == 0;
+            narrowIntegerOperations |= strcmp(argv[i], "--narrow-integer") == 0;
+        }
+
+        TestRecompiler::RecompileTests(path, argv[2], packedCrRegisters, narrowIntegerOperations);
     }
 
     return EXIT_SUCCESS;
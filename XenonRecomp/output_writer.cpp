@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "output_writer.h"
+
+OutputWriter::~OutputWriter()
+{
+    Flush();
+}
+
+void OutputWriter::Write(const std::filesystem::path& directoryPath, std::string name, std::string data)
+{
+    if (directoryPath != this->directoryPath)
+    {
+        Flush();
+
+        this->directoryPath = directoryPath;
+        LoadManifest();
+    }
+
+    if (!thread.joinable())
+    {
+        stopping = false;
+        thread = std::thread(&OutputWriter::Run, this);
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        jobs.push_back({ std::move(name), std::move(data) });
+    }
+
+    condition.notify_one();
+}
+
+void OutputWriter::Flush()
+{
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_one();
+    thread.join();
+
+    if (manifestChanged)
+        SaveManifest();
+}
+
+void OutputWriter::LoadManifest()
+{
+    manifest.clear();
+    manifestChanged = false;
+
+    std::ifstream stream(directoryPath / c_manifestFileName);
+    if (!stream.is_open())
+        return;
+
+    // Every line holds the hash, the size and the write time of a file, followed by its name.
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        ManifestEntry entry;
+        char name[512]{};
+        unsigned long long high = 0, low = 0, size = 0;
+        long long writeTime = 0;
+
+        if (sscanf(line.c_str(), "%16llx%16llx %llu %lld %511[^\n]", &high, &low, &size, &writeTime, name) != 5)
+            continue;
+
+        entry.hash.high64 = high;
+        entry.hash.low64 = low;
+        entry.size = size;
+        entry.writeTime = writeTime;
+        manifest.emplace(name, entry);
+    }
+}
+
+void OutputWriter::SaveManifest()
+{
+    // Written next to the manifest first, so an interrupted run can't leave it partially written.
+    std::filesystem::path path = directoryPath / c_manifestFileName;
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+
+    FILE* f = fopen(tempPath.string().c_str(), "w");
+    if (f == nullptr)
+    {
+        fmt::println("WARNING: Unable to write {}", path.string());
+        return;
+    }
+
+    // Sorted by name to keep the manifest stable between runs.
+    std::vector<const std::pair<const std::string, ManifestEntry>*> sorted;
+    for (auto& pair : manifest)
+        sorted.push_back(&pair);
+
+    std::sort(sorted.begin(), sorted.end(), [](auto lhs, auto rhs) { return lhs->first < rhs->first; });
+
+    for (auto pair : sorted)
+    {
+        const auto& entry = pair->second;
+        fmt::print(f, "{:016x}{:016x} {} {} {}\n", entry.hash.high64, entry.hash.low64, entry.size,
+            static_cast<long long>(entry.writeTime), pair->first);
+    }
+
+    fclose(f);
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+        fmt::println("WARNING: Unable to write {}", path.string());
+
+    manifestChanged = false;
+}
+
+void OutputWriter::Run()
+{
+    std::unique_lock lock(mutex);
+
+    while (true)
+    {
+        condition.wait(lock, [&]() { return !jobs.empty() || stopping; });
+        if (jobs.empty())
+            break;
+
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+
+        lock.unlock();
+        Process(job);
+        lock.lock();
+    }
+}
+
+void OutputWriter::Process(const Job& job)
+{
+    std::filesystem::path path = directoryPath / job.name;
+    XXH128_hash_t hash = XXH3_128bits(job.data.data(), job.data.size());
+
+    std::error_code ec;
+    auto writeTime = std::filesystem::last_write_time(path, ec);
+    bool exists = !ec;
+    size_t size = exists ? std::filesystem::file_size(path, ec) : 0;
+    exists = exists && !ec;
+
+    // The file is trusted to hold what the manifest says as long as nothing else has written to it since.
+    auto entry = manifest.find(job.name);
+    bool entryValid = exists && entry != manifest.end() && entry->second.size == size && entry->second.writeTime == writeTime.time_since_epoch().count();
+
+    bool shouldWrite = true;
+    if (entryValid)
+    {
+        shouldWrite = !XXH128_isEqual(entry->second.hash, hash);
+    }
+    else if (exists && size == job.data.size())
+    {
+        std::string temp(size, '\0');
+        FILE* f = fopen(path.string().c_str(), "rb");
+        if (f != nullptr)
+        {
+            shouldWrite = fread(temp.data(), 1, size, f) != size || temp != job.data;
+            fclose(f);
+        }
+    }
+
+    if (shouldWrite)
+    {
+        FILE* f = fopen(path.string().c_str(), "wb");
+        bool written = f != nullptr && fwrite(job.data.data(), 1, job.data.size(), f) == job.data.size();
+        if (f != nullptr)
+            written = fclose(f) == 0 && written;
+
+        if (!written)
+        {
+            fmt::println("ERROR: Unable to write {}", path.string());
+
+            if (entry != manifest.end())
+            {
+                manifest.erase(entry);
+                manifestChanged = true;
+            }
+
+            return;
+        }
+
+        ++writtenFileCount;
+        writtenByteCount += job.data.size();
+        writeTime = std::filesystem::last_write_time(path, ec);
+    }
+    else if (entryValid)
+    {
+        return;
+    }
+
+    ManifestEntry& newEntry = manifest[job.name];
+    newEntry.hash = hash;
+    newEntry.size = job.data.size();
+    newEntry.writeTime = ec ? 0 : writeTime.time_since_epoch().count();
+    manifestChanged = true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <xxhash.h>
+
+// Writes the output files on a background thread, skipping the ones that didn't change to not trigger recompilation.
+// The hash, size and write time of every file are kept in a manifest in the output directory, so unchanged files
+// can be detected without reading them back. Files missing from the manifest are compared against their contents once.
+struct OutputWriter
+{
+    static constexpr std::string_view c_manifestFileName = "ppc_manifest.txt";
+
+    struct ManifestEntry
+    {
+        XXH128_hash_t hash{};
+        size_t size{};
+        std::filesystem::file_time_type::rep writeTime{};
+    };
+
+    struct Job
+    {
+        std::string name;
+        std::string data;
+    };
+
+    std::filesystem::path directoryPath;
+    std::unordered_map<std::string, ManifestEntry> manifest;
+    bool manifestChanged{};
+
+    // Only accessed by the writer thread until Flush returns.
+    size_t writtenFileCount{};
+    size_t writtenByteCount{};
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Job> jobs;
+    bool stopping{};
+
+    OutputWriter() = default;
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+    ~OutputWriter();
+
+    // Queues the file to be written to the directory, which must stay the same until Flush is called.
+    void Write(const std::filesystem::path& directoryPath, std::string name, std::string data);
+
+    // Waits for all the queued files to be written and saves the manifest.
+    void Flush();
+
+    void LoadManifest();
+    void SaveManifest();
+    void Run();
+    void Process(const Job& job);
+};
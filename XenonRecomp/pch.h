@@ -10,6 +10,7 @@
 #include <fstream>
 #include <function.h>
 #include <image.h>
+#include <set>
 #include <toml++/toml.hpp>
 #include <unordered_map>
 #include <unordered_set>
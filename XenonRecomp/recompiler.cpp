@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "recompiler.h"
+#include <image_cache.h>
 #include <xex_patcher.h>
 
 static uint64_t ComputeMask(uint32_t mstart, uint32_t mstop)
@@ -10,91 +11,245 @@ static uint64_t ComputeMask(uint32_t mstart, uint32_t mstop)
     return mstart <= mstop ? value : ~value;
 }
 
+// Returns the cheapest expression equivalent to rotating a value left and masking the result,
+// where the mask doesn't wrap around and the expression evaluates to an unsigned integer of the specified width.
+static std::string RotateAndMask(const std::string_view& value, uint32_t width, uint32_t shift, uint64_t mask)
+{
+    const uint64_t all = UINT64_MAX >> (64 - width);
+    shift &= width - 1;
+    mask &= all;
+
+    if (shift == 0)
+        return mask == all ? std::string(value) : fmt::format("{} & 0x{:X}", value, mask);
+
+    // Bits rotated out at the top end up at the bottom, so a mask only keeping either side is a plain shift.
+    const uint64_t high = (all << shift) & all;
+    const uint64_t low = all >> (width - shift);
+
+    if ((mask & low) == 0)
+        return mask == high ? fmt::format("{} << {}", value, shift) : fmt::format("({} << {}) & 0x{:X}", value, shift, mask);
+
+    if ((mask & high) == 0)
+        return mask == low ? fmt::format("{} >> {}", value, width - shift) : fmt::format("({} >> {}) & 0x{:X}", value, width - shift, mask);
+
+    if (mask == all)
+        return fmt::format("__builtin_rotateleft{}({}, {})", width, value, shift);
+
+    return fmt::format("__builtin_rotateleft{}({}, {}) & 0x{:X}", width, value, shift, mask);
+}
+
 bool Recompiler::LoadConfig(const std::string_view& configFilePath)
 {
+    RecompilerStats::Scope scope(stats, "LoadConfig");
     config.Load(configFilePath);
 
+    // The cache is keyed by the input files rather than the patched one, so it's only reused when neither of them changed.
+    ImageCacheKey imageCacheKey{};
+    if (!config.imageCacheFilePath.empty())
+    {
+        bool imageCacheLoaded;
+        {
+            RecompilerStats::Scope imageCacheScope(stats, "LoadImageCache");
+            imageCacheKey = ComputeImageCacheKey(config.directoryPath + config.filePath,
+                config.patchFilePath.empty() ? std::string() : config.directoryPath + config.patchFilePath);
+
+            imageCacheLoaded = LoadImageCache(config.directoryPath + config.imageCacheFilePath, imageCacheKey, image);
+            imageCacheScope.bytes = image.size;
+        }
+
+        if (imageCacheLoaded)
+            return config.profileFilePath.empty() || LoadProfile();
+    }
+
     std::vector<uint8_t> file;
-    if (!config.patchedFilePath.empty())
-        file = LoadFile((config.directoryPath + config.patchedFilePath).c_str());
+    bool patchedFileExists = !config.patchedFilePath.empty() && std::filesystem::exists(config.directoryPath + config.patchedFilePath);
 
-    if (file.empty())
+    if (!patchedFileExists && !config.patchFilePath.empty())
     {
-        file = LoadFile((config.directoryPath + config.filePath).c_str());
+        RecompilerStats::Scope patchScope(stats, "Patch");
+        XexPatcher::Result result;
 
-        if (!config.patchFilePath.empty())
+        if (!config.patchedFilePath.empty())
+        {
+            // The patcher writes the patched file directly, which is then mapped like an unpatched one.
+            result = XexPatcher::apply(config.directoryPath + config.filePath, config.directoryPath + config.patchFilePath,
+                config.directoryPath + config.patchedFilePath);
+
+            patchedFileExists = result == XexPatcher::Result::Success;
+        }
+        else
         {
+            file = LoadFile((config.directoryPath + config.filePath).c_str());
+
             const auto patchFile = LoadFile((config.directoryPath + config.patchFilePath).c_str());
-            if (!patchFile.empty())
+            if (patchFile.empty())
             {
-                std::vector<uint8_t> outBytes;
-                auto result = XexPatcher::apply(file.data(), file.size(), patchFile.data(), patchFile.size(), outBytes, false);
-                if (result == XexPatcher::Result::Success)
-                {
-                    std::exchange(file, outBytes);
+                fmt::println("ERROR: Unable to load the patch file");
+                return false;
+            }
 
-                    if (!config.patchedFilePath.empty())
-                    {
-                        std::ofstream stream(config.directoryPath + config.patchedFilePath, std::ios::binary);
-                        if (stream.good())
-                        {
-                            stream.write(reinterpret_cast<const char*>(file.data()), file.size());
-                            stream.close();
-                        }
-                    }
-                }
-                else
-                {
-                    fmt::print("ERROR: Unable to apply the patch file, ");
+            std::vector<uint8_t> outBytes;
+            result = XexPatcher::apply(file.data(), file.size(), patchFile.data(), patchFile.size(), outBytes, false);
+            std::exchange(file, outBytes);
+        }
 
-                    switch (result)
-                    {
-                    case XexPatcher::Result::XexFileUnsupported:
-                        fmt::println("XEX file unsupported");
-                        break;
+        if (result != XexPatcher::Result::Success)
+        {
+            fmt::print("ERROR: Unable to apply the patch file, ");
 
-                    case XexPatcher::Result::XexFileInvalid:
-                        fmt::println("XEX file invalid");
-                        break;
+            switch (result)
+            {
+            case XexPatcher::Result::FileOpenFailed:
+                fmt::println("file open failed");
+                break;
 
-                    case XexPatcher::Result::PatchFileInvalid:
-                        fmt::println("patch file invalid");
-                        break;
+            case XexPatcher::Result::FileWriteFailed:
+                fmt::println("file write failed");
+                break;
 
-                    case XexPatcher::Result::PatchIncompatible:
-                        fmt::println("patch file incompatible");
-                        break;
+            case XexPatcher::Result::XexFileUnsupported:
+                fmt::println("XEX file unsupported");
+                break;
 
-                    case XexPatcher::Result::PatchFailed:
-                        fmt::println("patch failed");
-                        break;
+            case XexPatcher::Result::XexFileInvalid:
+                fmt::println("XEX file invalid");
+                break;
 
-                    case XexPatcher::Result::PatchUnsupported:
-                        fmt::println("patch unsupported");
-                        break;
+            case XexPatcher::Result::PatchFileInvalid:
+                fmt::println("patch file invalid");
+                break;
 
-                    default:
-                        fmt::println("reason unknown");
-                        break;
-                    }
+            case XexPatcher::Result::PatchIncompatible:
+                fmt::println("patch file incompatible");
+                break;
 
-                    return false;
-                }
-            }
-            else
-            {
-                fmt::println("ERROR: Unable to load the patch file");
-                return false;
+            case XexPatcher::Result::PatchFailed:
+                fmt::println("patch failed");
+                break;
+
+            case XexPatcher::Result::PatchUnsupported:
+                fmt::println("patch unsupported");
+                break;
+
+            default:
+                fmt::println("reason unknown");
+                break;
             }
+
+            return false;
+        }
+    }
+
+    // Files used as they are get mapped rather than read, so images stored uncompressed reference the mapping instead of a copy.
+    {
+        RecompilerStats::Scope parseImageScope(stats, "ParseImage");
+
+        if (file.empty())
+            image = Image::ParseImage(config.directoryPath + (patchedFileExists ? config.patchedFilePath : config.filePath), !config.skipHashVerification);
+        else
+            image = Image::ParseImage(file.data(), file.size(), !config.skipHashVerification);
+
+        parseImageScope.bytes = image.size;
+    }
+
+    if (!config.imageCacheFilePath.empty())
+    {
+        RecompilerStats::Scope imageCacheScope(stats, "SaveImageCache");
+        if (!SaveImageCache(config.directoryPath + config.imageCacheFilePath, imageCacheKey, image))
+            fmt::println("WARNING: Unable to save the image cache");
+    }
+
+    if (!config.profileFilePath.empty() && !LoadProfile())
+        return false;
+
+    return true;
+}
+
+bool Recompiler::LoadProfile()
+{
+    const auto profileFile = LoadFile((config.directoryPath + config.profileFilePath).c_str());
+    if (profileFile.empty())
+    {
+        fmt::println("ERROR: Unable to load the profile file");
+        return false;
+    }
+
+    if (config.profileMapFilePath.empty())
+    {
+        fmt::println("ERROR: Profile map file path is unspecified");
+        return false;
+    }
+
+    toml::table profileMap;
+#if TOML_EXCEPTIONS
+    try
+    {
+        profileMap = toml::parse_file(config.directoryPath + config.profileMapFilePath);
+    }
+    catch (const toml::parse_error& error)
+    {
+        fmt::println("ERROR: Unable to parse the profile map: {}", error.description());
+        return false;
+    }
+#else
+    auto profileMapResult = toml::parse_file(config.directoryPath + config.profileMapFilePath);
+    if (!profileMapResult)
+    {
+        fmt::println("ERROR: Unable to parse the profile map: {}", profileMapResult.error().description());
+        return false;
+    }
+
+    profileMap = std::move(profileMapResult).table();
+#endif
+
+    auto functionArray = profileMap["functions"].as_array();
+    auto blockArray = profileMap["blocks"].as_array();
+    auto indirectCallArray = profileMap["indirect_calls"].as_array();
+    size_t blockCount = blockArray != nullptr ? blockArray->size() : 0;
+    size_t indirectCallCount = indirectCallArray != nullptr ? indirectCallArray->size() : 0;
+
+    // The dump contains the function counters, the block counters and the last indirect call targets in order.
+    if (functionArray == nullptr || profileFile.size() != (functionArray->size() + blockCount + indirectCallCount) * sizeof(uint64_t))
+    {
+        fmt::println("ERROR: Profile file does not match the profile map");
+        return false;
+    }
+
+    auto* counters = reinterpret_cast<const uint64_t*>(profileFile.data());
+    for (size_t i = 0; i < functionArray->size(); i++)
+    {
+        auto address = (*functionArray)[i].value<uint32_t>();
+        if (!address)
+        {
+            fmt::println("ERROR: Invalid profile map");
+            return false;
+        }
+
+        profileCounts[*address] += counters[i];
+    }
+
+    // Seed the inline caches of indirect calls that were not explicitly specified in the config.
+    auto* indirectCallTargets = counters + functionArray->size() + blockCount;
+    for (size_t i = 0; i < indirectCallCount; i++)
+    {
+        auto address = (*indirectCallArray)[i].value<uint32_t>();
+        if (!address)
+        {
+            fmt::println("ERROR: Invalid profile map");
+            return false;
         }
+
+        if (indirectCallTargets[i] != 0)
+            config.indirectCalls.emplace(*address, RecompilerIndirectCall{ { uint32_t(indirectCallTargets[i]) } });
     }
 
-    image = Image::ParseImage(file.data(), file.size());
     return true;
 }
 
 void Recompiler::Analyse()
 {
+    RecompilerStats::Scope scope(stats, "Analyse");
+
     for (size_t i = 14; i < 128; i++)
     {
         if (i < 32)
@@ -252,6 +407,593 @@ void Recompiler::Analyse()
     }
 
     std::sort(functions.begin(), functions.end(), [](auto& lhs, auto& rhs) { return lhs.base < rhs.base; });
+
+    if (config.unreachableFunctions != RecompilerUnreachableFunctions::Keep)
+        AnalyseReachability();
+
+    if (config.deduplicateFunctions)
+        DeduplicateFunctions();
+
+    if (!profileCounts.empty())
+        ApplyProfile();
+
+    scope.items = functions.size();
+}
+
+void Recompiler::AnalyseReachability()
+{
+    std::unordered_map<size_t, size_t> functionIndices;
+    for (size_t i = 0; i < functions.size(); i++)
+        functionIndices.emplace(functions[i].base, i);
+
+    // Every function has a symbol of the same size. The ones without a size contain nothing, but are still found by their own address.
+    auto findFunction = [&](size_t address) -> size_t
+        {
+            auto symbol = image.symbols.find_containing(address);
+            auto findResult = functionIndices.find(symbol != image.symbols.end() ? symbol->address : address);
+            return findResult != functionIndices.end() ? findResult->second : functions.size();
+        };
+
+    std::vector<bool> reachable(functions.size());
+    std::vector<size_t> worklist;
+
+    auto markReachable = [&](size_t address)
+        {
+            size_t index = findFunction(address);
+            if (index != functions.size() && !reachable[index])
+            {
+                reachable[index] = true;
+                worklist.push_back(index);
+            }
+        };
+
+    // Targets that are not visible in the instructions, but are still reached from within a function.
+    std::unordered_multimap<size_t, size_t> implicitTargets;
+
+    for (auto& [address, indirectCall] : config.indirectCalls)
+    {
+        for (auto target : indirectCall.targets)
+            implicitTargets.emplace(findFunction(address), target);
+    }
+
+    for (auto& [address, switchTable] : config.switchTables)
+    {
+        for (auto label : switchTable.labels)
+            implicitTargets.emplace(findFunction(address), label);
+    }
+
+    for (auto& [address, midAsmHook] : config.midAsmHooks)
+    {
+        for (auto target : { midAsmHook.jumpAddress, midAsmHook.jumpAddressOnTrue, midAsmHook.jumpAddressOnFalse })
+        {
+            if (target != 0)
+                implicitTargets.emplace(findFunction(address), target);
+        }
+    }
+
+    markReachable(image.entry_point);
+
+    for (auto address : config.reachableFunctions)
+        markReachable(address);
+
+    // Any word in a data section pointing at code might be a function pointer or a virtual table entry.
+    // Metadata sections are skipped, as .pdata alone holds the start of every function.
+    constexpr std::string_view metadataSections[] = { ".pdata", ".reloc", ".XBLD" };
+    for (const auto& section : image.sections)
+    {
+        if ((section.flags & SectionFlags_Code) != 0 || section.data == nullptr ||
+            std::find(std::begin(metadataSections), std::end(metadataSections), section.name) != std::end(metadataSections))
+        {
+            continue;
+        }
+
+        auto* words = reinterpret_cast<const be<uint32_t>*>(section.data);
+        for (size_t i = 0; i < section.size / sizeof(uint32_t); i++)
+            markReachable(words[i]);
+    }
+
+    while (!worklist.empty())
+    {
+        auto& fn = functions[worklist.back()];
+        size_t index = worklist.back();
+        worklist.pop_back();
+
+        auto [implicitBegin, implicitEnd] = implicitTargets.equal_range(index);
+        for (auto it = implicitBegin; it != implicitEnd; ++it)
+            markReachable(it->second);
+
+        auto* data = reinterpret_cast<const uint32_t*>(image.Find(fn.base));
+        if (data == nullptr)
+            continue;
+
+        // Pointers built with lis followed by addi or ori, for function pointers passed as arguments.
+        uint32_t highBits[32]{};
+
+        for (size_t i = 0; i < fn.size / sizeof(uint32_t); i++)
+        {
+            uint32_t insn = ByteSwap(data[i]);
+            size_t address = fn.base + i * sizeof(uint32_t);
+            uint32_t rt = (insn >> 21) & 0x1F;
+            uint32_t ra = (insn >> 16) & 0x1F;
+
+            switch (PPC_OP(insn))
+            {
+            case PPC_OP_B:
+                markReachable(PPC_BI(insn) + (PPC_BA(insn) ? 0 : address));
+                break;
+
+            case PPC_OP_BC:
+                markReachable(PPC_BD(insn) + (PPC_BA(insn) ? 0 : address));
+                break;
+
+            case PPC_OP_ADDIS:
+                if (ra == 0)
+                    highBits[rt] = insn << 16;
+                break;
+
+            case PPC_OP_ADDI:
+                if (ra != 0)
+                    markReachable(highBits[ra] + int16_t(insn));
+                break;
+
+            case PPC_OP_ORI:
+                markReachable(highBits[rt] | (insn & 0xFFFF));
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < functions.size(); i++)
+    {
+        if (!reachable[i])
+            unreachableFunctions.emplace(functions[i].base);
+    }
+
+    fmt::println("Reachability: {} of {} functions are unreachable", unreachableFunctions.size(), functions.size());
+
+    if (config.unreachableFunctions == RecompilerUnreachableFunctions::Skip)
+    {
+        image.symbols.erase_if([&](auto& symbol) { return unreachableFunctions.find(symbol.address) != unreachableFunctions.end(); });
+
+        functions.erase(std::remove_if(functions.begin(), functions.end(), [&](auto& fn) { return unreachableFunctions.find(fn.base) != unreachableFunctions.end(); }), functions.end());
+    }
+    else
+    {
+        coldFunctions.insert(unreachableFunctions.begin(), unreachableFunctions.end());
+
+        std::stable_sort(functions.begin(), functions.end(), [&](auto& lhs, auto& rhs)
+            {
+                return unreachableFunctions.find(lhs.base) == unreachableFunctions.end() && unreachableFunctions.find(rhs.base) != unreachableFunctions.end();
+            });
+    }
+}
+
+void Recompiler::DeduplicateFunctions()
+{
+    // Instrumented functions emit their own address and counter ordinals, so none of them are identical.
+    if (config.profileInstrumentation || config.guestPcMarkers)
+        return;
+
+    // Per-address configuration would only apply to one of the functions.
+    auto hasAddressConfig = [&](const Function& fn)
+        {
+            for (size_t address = fn.base; address < fn.base + fn.size; address += 4)
+            {
+                if (config.switchTables.find(address) != config.switchTables.end() ||
+                    config.midAsmHooks.find(address) != config.midAsmHooks.end() ||
+                    config.indirectCalls.find(address) != config.indirectCalls.end())
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        };
+
+    // Branches within the function are already position independent. Branches leaving the function
+    // are replaced with their absolute target, which has to match for the functions to be identical.
+    auto normalise = [&](const Function& fn, std::string& normalised)
+        {
+            auto* data = reinterpret_cast<const uint32_t*>(image.Find(fn.base));
+            if (data == nullptr)
+                return false;
+
+            for (size_t i = 0; i < fn.size / sizeof(uint32_t); i++)
+            {
+                uint32_t insn = ByteSwap(data[i]);
+                size_t address = fn.base + i * sizeof(uint32_t);
+                uint32_t op = PPC_OP(insn);
+
+                // Linking branches store their own address to the link register.
+                if (!config.skipLr && (op == PPC_OP_B || op == PPC_OP_BC || op == PPC_OP_CTR) && PPC_BL(insn))
+                    return false;
+
+                if ((op == PPC_OP_B || op == PPC_OP_BC) && !PPC_BA(insn))
+                {
+                    size_t target = address + (op == PPC_OP_B ? PPC_BI(insn) : PPC_BD(insn));
+                    if (target < fn.base || target >= fn.base + fn.size)
+                    {
+                        uint32_t absolute[] = { insn & (op == PPC_OP_B ? ~0x3FFFFFCu : ~0xFFFCu), uint32_t(target) };
+                        normalised.append(reinterpret_cast<const char*>(absolute), sizeof(absolute));
+                        continue;
+                    }
+                }
+
+                normalised.append(reinterpret_cast<const char*>(&insn), sizeof(insn));
+            }
+
+            return true;
+        };
+
+    std::unordered_map<XXH64_hash_t, std::vector<std::pair<size_t, std::string>>> canonicalFunctions;
+    std::unordered_set<size_t> duplicates;
+    std::string normalised;
+
+    for (auto& fn : functions)
+    {
+        auto symbol = image.symbols.find(fn.base);
+        if (fn.size == 0 || symbol == image.symbols.end() || symbol->address != fn.base || symbol->name.find("sub_") != 0 ||
+            fn.base == config.longJmpAddress || fn.base == config.setJmpAddress || hasAddressConfig(fn))
+        {
+            continue;
+        }
+
+        normalised.clear();
+        if (!normalise(fn, normalised))
+            continue;
+
+        auto& candidates = canonicalFunctions[XXH3_64bits(normalised.data(), normalised.size())];
+        auto canonical = std::find_if(candidates.begin(), candidates.end(), [&](auto& candidate) { return candidate.second == normalised; });
+
+        if (canonical != candidates.end())
+        {
+            duplicateFunctions[canonical->first].push_back(fn.base);
+            duplicates.emplace(fn.base);
+        }
+        else
+        {
+            candidates.emplace_back(fn.base, normalised);
+        }
+    }
+
+    functions.erase(std::remove_if(functions.begin(), functions.end(), [&](auto& fn) { return duplicates.find(fn.base) != duplicates.end(); }), functions.end());
+
+    fmt::println("Deduplication: {} functions are identical to another function", duplicates.size());
+}
+
+void Recompiler::ApplyProfile()
+{
+    std::vector<std::pair<size_t, uint64_t>> entries;
+    uint64_t totalCount = 0;
+
+    for (auto& fn : functions)
+    {
+        auto findResult = profileCounts.find(fn.base);
+        if (findResult == profileCounts.end())
+            continue;
+
+        if (findResult->second == 0)
+        {
+            coldFunctions.emplace(fn.base);
+        }
+        else
+        {
+            entries.emplace_back(fn.base, findResult->second);
+            totalCount += findResult->second;
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](auto& lhs, auto& rhs) { return lhs.second > rhs.second; });
+
+    // The smallest set of functions covering most of the entries is considered hot.
+    uint64_t coveredCount = 0;
+    for (auto& [address, count] : entries)
+    {
+        if (coveredCount >= totalCount * c_hotFunctionCoverage)
+            break;
+
+        hotFunctions.emplace(address);
+        coveredCount += count;
+    }
+
+    // Hot functions go first from the most frequently entered one, so they end up packed together 
+    // in the same output files. Cold functions go last. Everything else keeps the address order.
+    auto getRank = [&](size_t address)
+        {
+            if (hotFunctions.find(address) != hotFunctions.end())
+                return 0;
+            if (coldFunctions.find(address) != coldFunctions.end())
+                return 2;
+            return 1;
+        };
+
+    std::stable_sort(functions.begin(), functions.end(), [&](auto& lhs, auto& rhs)
+        {
+            int lhsRank = getRank(lhs.base);
+            int rhsRank = getRank(rhs.base);
+            if (lhsRank != rhsRank)
+                return lhsRank < rhsRank;
+            if (lhsRank == 0)
+                return profileCounts[lhs.base] > profileCounts[rhs.base];
+            return false;
+        });
+
+    fmt::println("Profile: {} hot functions, {} cold functions", hotFunctions.size(), coldFunctions.size());
+}
+
+void Recompiler::AnalyseOperandWidths(const Function& fn)
+{
+    narrowInstructions.clear();
+
+    // Every bit represents a general purpose register.
+    constexpr uint32_t c_allRegisters = ~0u;
+
+    struct Instruction
+    {
+        // Registers with their upper half read regardless of how the result is used
+        uint32_t wide = 0;
+        // Registers overwritten in full
+        uint32_t kill = 0;
+        // Registers with their upper half read only if the upper half of the result is observed
+        uint32_t sources = 0;
+        // Registers with their upper half observed before the instruction
+        uint32_t observed = 0;
+        size_t target = 0;
+        bool hasTarget = false;
+        bool fallthrough = true;
+        bool narrowable = false;
+    };
+
+    size_t count = fn.size / 4;
+    std::vector<Instruction> instructions(count);
+    auto* data = (const uint32_t*)image.Find(fn.base);
+
+    ppc_insn insn;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& instruction = instructions[i];
+        size_t base = fn.base + i * 4;
+
+        // Hooks can read any register in full.
+        if (config.midAsmHooks.find(base) != config.midAsmHooks.end())
+        {
+            instruction.wide = c_allRegisters;
+            continue;
+        }
+
+        uint32_t raw = ByteSwap(data[i]);
+        uint32_t op = PPC_OP(raw);
+
+        // Vector and floating point instructions never write general purpose registers,
+        // and the VMX128 loads and stores only use the lower half of the address registers.
+        if (op == 4 || op == 5 || op == 6 || op == 59 || op == 63)
+            continue;
+
+        if ((op == PPC_OP_B || op == PPC_OP_BC) && !PPC_BL(raw))
+        {
+            size_t target = base + (op == PPC_OP_B ? PPC_BI(raw) : PPC_BD(raw));
+            if (PPC_BA(raw) || target < fn.base || target >= fn.base + fn.size)
+            {
+                instruction.wide = c_allRegisters;
+            }
+            else
+            {
+                instruction.target = (target - fn.base) / 4;
+                instruction.hasTarget = true;
+                instruction.fallthrough = op == PPC_OP_BC && (PPC_BO(raw) & 0x14) != 0x14;
+            }
+            continue;
+        }
+
+        if (op == PPC_OP_CTR && PPC_XOP(raw) == 16 && !PPC_BL(raw))
+        {
+            instruction.wide = returnRegisters;
+            instruction.fallthrough = (PPC_BO(raw) & 0x14) != 0x14;
+            continue;
+        }
+
+        ppc::Disassemble(data + i, 4, base, insn);
+        if (insn.opcode == nullptr)
+        {
+            instruction.wide = c_allRegisters;
+            continue;
+        }
+
+        auto bit = [&](size_t index) { return 1u << insn.operands[index]; };
+
+        switch (insn.opcode->id)
+        {
+        case PPC_INST_ADD:
+        case PPC_INST_AND:
+        case PPC_INST_ANDC:
+        case PPC_INST_NAND:
+        case PPC_INST_NOR:
+        case PPC_INST_OR:
+        case PPC_INST_ORC:
+        case PPC_INST_SUBF:
+        case PPC_INST_XOR:
+            instruction.kill = bit(0);
+            instruction.sources = bit(1) | bit(2);
+            instruction.narrowable = true;
+            break;
+
+        case PPC_INST_ADDI:
+        case PPC_INST_ADDIS:
+            instruction.kill = bit(0);
+            if (insn.operands[1] != 0)
+            {
+                instruction.sources = bit(1);
+                instruction.narrowable = true;
+            }
+            break;
+
+        case PPC_INST_MR:
+        case PPC_INST_MULLI:
+        case PPC_INST_NEG:
+        case PPC_INST_NOT:
+        case PPC_INST_ORI:
+        case PPC_INST_ORIS:
+        case PPC_INST_XORI:
+        case PPC_INST_XORIS:
+            instruction.kill = bit(0);
+            instruction.sources = bit(1);
+            instruction.narrowable = true;
+            break;
+
+        case PPC_INST_MULLW:
+            instruction.kill = bit(0);
+            instruction.narrowable = true;
+            break;
+
+        // Write the destination in full, reading only the lower half of the sources.
+        case PPC_INST_ANDI:
+        case PPC_INST_ANDIS:
+        case PPC_INST_CLRLWI:
+        case PPC_INST_CNTLZW:
+        case PPC_INST_EXTSB:
+        case PPC_INST_EXTSH:
+        case PPC_INST_EXTSW:
+        case PPC_INST_LBZ:
+        case PPC_INST_LBZU:
+        case PPC_INST_LBZX:
+        case PPC_INST_LD:
+        case PPC_INST_LDU:
+        case PPC_INST_LDX:
+        case PPC_INST_LHA:
+        case PPC_INST_LHAX:
+        case PPC_INST_LHZ:
+        case PPC_INST_LHZX:
+        case PPC_INST_LI:
+        case PPC_INST_LIS:
+        case PPC_INST_LWA:
+        case PPC_INST_LWAX:
+        case PPC_INST_LWBRX:
+        case PPC_INST_LWZ:
+        case PPC_INST_LWZU:
+        case PPC_INST_LWZX:
+        case PPC_INST_MULHW:
+        case PPC_INST_MULHWU:
+        case PPC_INST_RLWINM:
+        case PPC_INST_ROTLW:
+        case PPC_INST_ROTLWI:
+        case PPC_INST_SLW:
+        case PPC_INST_SRAW:
+        case PPC_INST_SRAWI:
+        case PPC_INST_SRW:
+            instruction.kill = bit(0);
+            break;
+
+        // Read only the lower half of general purpose registers and write at most the lower half of them.
+        case PPC_INST_CCTPL:
+        case PPC_INST_CCTPM:
+        case PPC_INST_CMPLW:
+        case PPC_INST_CMPLWI:
+        case PPC_INST_CMPW:
+        case PPC_INST_CMPWI:
+        case PPC_INST_DB16CYC:
+        case PPC_INST_DCBF:
+        case PPC_INST_DCBT:
+        case PPC_INST_DCBTST:
+        case PPC_INST_DCBZ:
+        case PPC_INST_DCBZL:
+        case PPC_INST_DIVW:
+        case PPC_INST_DIVWU:
+        case PPC_INST_EIEIO:
+        case PPC_INST_LFD:
+        case PPC_INST_LFDX:
+        case PPC_INST_LFS:
+        case PPC_INST_LFSX:
+        case PPC_INST_LVEWX:
+        case PPC_INST_LVLX:
+        case PPC_INST_LVRX:
+        case PPC_INST_LVSL:
+        case PPC_INST_LVSR:
+        case PPC_INST_LVX:
+        case PPC_INST_LWSYNC:
+        case PPC_INST_NOP:
+        case PPC_INST_RLWIMI:
+        case PPC_INST_STB:
+        case PPC_INST_STBU:
+        case PPC_INST_STBX:
+        case PPC_INST_STFD:
+        case PPC_INST_STFDX:
+        case PPC_INST_STFIWX:
+        case PPC_INST_STFS:
+        case PPC_INST_STFSX:
+        case PPC_INST_STH:
+        case PPC_INST_STHBRX:
+        case PPC_INST_STHX:
+        case PPC_INST_STVEHX:
+        case PPC_INST_STVEWX:
+        case PPC_INST_STVLX:
+        case PPC_INST_STVRX:
+        case PPC_INST_STVX:
+        case PPC_INST_STW:
+        case PPC_INST_STWBRX:
+        case PPC_INST_STWU:
+        case PPC_INST_STWUX:
+        case PPC_INST_STWX:
+        case PPC_INST_SYNC:
+            break;
+
+        case PPC_INST_CMPD:
+        case PPC_INST_CMPLD:
+            instruction.wide = bit(1) | bit(2);
+            break;
+
+        case PPC_INST_CMPDI:
+        case PPC_INST_CMPLDI:
+            instruction.wide = bit(1);
+            break;
+
+        case PPC_INST_STD:
+        case PPC_INST_STDU:
+        case PPC_INST_STDX:
+            instruction.wide = bit(0);
+            break;
+
+        // Calls, returns and anything else that isn't known to leave the upper halves alone.
+        default:
+            instruction.wide = c_allRegisters;
+            break;
+        }
+    }
+
+    auto getObserved = [&](size_t index)
+        {
+            auto& instruction = instructions[index];
+            uint32_t observed = 0;
+            if (instruction.fallthrough)
+                observed |= index + 1 < count ? instructions[index + 1].observed : c_allRegisters;
+            if (instruction.hasTarget)
+                observed |= instructions[instruction.target].observed;
+
+            return observed;
+        };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = count; i-- > 0;)
+        {
+            auto& instruction = instructions[i];
+            uint32_t observed = getObserved(i);
+            observed = instruction.wide | (observed & ~instruction.kill) | ((observed & instruction.kill) != 0 ? instruction.sources : 0);
+
+            if (instruction.observed != observed)
+            {
+                instruction.observed = observed;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (instructions[i].narrowable && (getObserved(i) & instructions[i].kill) == 0)
+            narrowInstructions.emplace(fn.base + i * 4);
+    }
 }
 
 bool Recompiler::Recompile(
@@ -272,8 +1014,11 @@ bool Recompiler::Recompile(
                 (config.nonVolatileRegistersAsLocalVariables && index >= 14))
             {
                 localVariables.r[index] = true;
+                ++functionStats.localAccessCount;
                 return fmt::format("r{}", index);
             }
+
+            ++functionStats.contextAccessCount;
             return fmt::format("ctx.r{}", index);
         };
 
@@ -283,8 +1028,11 @@ bool Recompiler::Recompile(
                 (config.nonVolatileRegistersAsLocalVariables && index >= 14))
             {
                 localVariables.f[index] = true;
+                ++functionStats.localAccessCount;
                 return fmt::format("f{}", index);
             }
+
+            ++functionStats.contextAccessCount;
             return fmt::format("ctx.f{}", index);
         };
 
@@ -294,8 +1042,11 @@ bool Recompiler::Recompile(
                 (config.nonVolatileRegistersAsLocalVariables && ((index >= 14 && index <= 31) || (index >= 64 && index <= 127))))
             {
                 localVariables.v[index] = true;
+                ++functionStats.localAccessCount;
                 return fmt::format("v{}", index);
             }
+
+            ++functionStats.contextAccessCount;
             return fmt::format("ctx.v{}", index);
         };
 
@@ -304,8 +1055,11 @@ bool Recompiler::Recompile(
             if (config.crRegistersAsLocalVariables)
             {
                 localVariables.cr[index] = true;
+                ++functionStats.localAccessCount;
                 return fmt::format("cr{}", index);
             }
+
+            ++functionStats.contextAccessCount;
             return fmt::format("ctx.cr{}", index);
         };
 
@@ -314,8 +1068,11 @@ bool Recompiler::Recompile(
             if (config.ctrAsLocalVariable)
             {
                 localVariables.ctr = true;
+                ++functionStats.localAccessCount;
                 return "ctr";
             }
+
+            ++functionStats.contextAccessCount;
             return "ctx.ctr";
         };
 
@@ -324,8 +1081,11 @@ bool Recompiler::Recompile(
             if (config.xerAsLocalVariable)
             {
                 localVariables.xer = true;
+                ++functionStats.localAccessCount;
                 return "xer";
             }
+
+            ++functionStats.contextAccessCount;
             return "ctx.xer";
         };
 
@@ -334,8 +1094,11 @@ bool Recompiler::Recompile(
             if (config.reservedRegisterAsLocalVariable)
             {
                 localVariables.reserved = true;
+                ++functionStats.localAccessCount;
                 return "reserved";
             }
+
+            ++functionStats.contextAccessCount;
             return "ctx.reserved";
         };
 
@@ -395,6 +1158,8 @@ bool Recompiler::Recompile(
                     else
                     {
                         println("\t{}(ctx, base);", targetSymbol->name);
+                        shardCallTargets.emplace(targetSymbol->name);
+                        ++functionStats.callCount;
                     }
                 }
                 else
@@ -404,6 +1169,58 @@ bool Recompiler::Recompile(
             }
         };
 
+    auto printIndirectFunctionCall = [&](const std::string_view& indent)
+        {
+            if (config.profileInstrumentation)
+            {
+                println("{}\tPPC_PROFILE_INDIRECT({}, {}.u32);", indent, profileIndirectCalls.size(), ctr());
+                profileIndirectCalls.push_back(base);
+            }
+
+            // Compare against the expected targets to call them directly, falling back to the function table.
+            auto indirectCall = config.indirectCalls.find(base);
+            if (indirectCall != config.indirectCalls.end())
+            {
+                std::vector<uint32_t> targets;
+                for (auto target : indirectCall->second.targets)
+                {
+                    auto targetSymbol = image.symbols.find(target);
+                    if (targetSymbol == image.symbols.end() || targetSymbol->address != target || targetSymbol->type != Symbol_Function ||
+                        target == config.longJmpAddress || target == config.setJmpAddress || targetSymbol->name.find("__rest") == 0 || targetSymbol->name.find("__save") == 0)
+                    {
+                        fmt::println("ERROR: Indirect call at {:X} has an invalid target: {:X}", base, target);
+                        continue;
+                    }
+
+                    targets.push_back(target);
+                }
+
+                // The target is known to be the only possible one, so the call doesn't need to be checked.
+                if (indirectCall->second.direct && targets.size() == 1 && indirectCall->second.targets.size() == 1)
+                {
+                    print("{}", indent);
+                    printFunctionCall(targets[0]);
+                    return;
+                }
+
+                for (size_t i = 0; i < targets.size(); i++)
+                {
+                    println("{}\t{}if ({}.u32 == 0x{:X})", indent, i != 0 ? "else " : "", ctr(), targets[i]);
+                    print("{}\t", indent);
+                    printFunctionCall(targets[i]);
+                }
+
+                if (!targets.empty())
+                {
+                    println("{}\telse", indent);
+                    print("\t");
+                }
+            }
+
+            println("{}\tPPC_CALL_INDIRECT_FUNC({}.u32);", indent, ctr());
+            ++functionStats.indirectCallCount;
+        };
+
     auto printConditionalBranch = [&](bool not_, const std::string_view& cond)
         {
             if (insn.operands[1] < fn.base || insn.operands[1] >= fn.base + fn.size)
@@ -430,6 +1247,7 @@ bool Recompiler::Recompile(
                 println("\tctx.fpscr.{}FlushMode{}();", prefix, suffix);
 
                 csrState = newState;
+                ++functionStats.csrModeSwitchCount;
             }
         };
 
@@ -523,10 +1341,16 @@ bool Recompiler::Recompile(
     if (id == PPC_INST_VUPKHSB128 && insn.operands[2] == 0x60) id = PPC_INST_VUPKHSH128;
     else if (id == PPC_INST_VUPKLSB128 && insn.operands[2] == 0x60) id = PPC_INST_VUPKLSH128;
 
+    // The upper half of the result is never observed, so a 32-bit operation is enough.
+    bool narrow = narrowInstructions.find(base) != narrowInstructions.end();
+
     switch (id)
     {
     case PPC_INST_ADD:
-        println("\t{}.u64 = {}.u64 + {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 + {}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = {}.u64 + {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
@@ -540,10 +1364,17 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_ADDI:
-        print("\t{}.s64 = ", r(insn.operands[0]));
-        if (insn.operands[1] != 0)
-            print("{}.s64 + ", r(insn.operands[1]));
-        println("{};", int32_t(insn.operands[2]));
+        if (narrow)
+        {
+            println("\t{}.u64 = {}.u32 + {};", r(insn.operands[0]), r(insn.operands[1]), int32_t(insn.operands[2]));
+        }
+        else
+        {
+            print("\t{}.s64 = ", r(insn.operands[0]));
+            if (insn.operands[1] != 0)
+                print("{}.s64 + ", r(insn.operands[1]));
+            println("{};", int32_t(insn.operands[2]));
+        }
         break;
 
     case PPC_INST_ADDIC:
@@ -554,10 +1385,17 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_ADDIS:
-        print("\t{}.s64 = ", r(insn.operands[0]));
-        if (insn.operands[1] != 0)
-            print("{}.s64 + ", r(insn.operands[1]));
-        println("{};", static_cast<int32_t>(insn.operands[2] << 16));
+        if (narrow)
+        {
+            println("\t{}.u64 = {}.u32 + {};", r(insn.operands[0]), r(insn.operands[1]), static_cast<int32_t>(insn.operands[2] << 16));
+        }
+        else
+        {
+            print("\t{}.s64 = ", r(insn.operands[0]));
+            if (insn.operands[1] != 0)
+                print("{}.s64 + ", r(insn.operands[1]));
+            println("{};", static_cast<int32_t>(insn.operands[2] << 16));
+        }
         break;
 
     case PPC_INST_ADDZE:
@@ -569,13 +1407,19 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_AND:
-        println("\t{}.u64 = {}.u64 & {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 & {}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = {}.u64 & {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_ANDC:
-        println("\t{}.u64 = {}.u64 & ~{}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 & ~{}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = {}.u64 & ~{}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
@@ -610,6 +1454,7 @@ bool Recompiler::Recompile(
         if (switchTable != config.switchTables.end())
         {
             println("\tswitch ({}.u64) {{", r(switchTable->second.r));
+            ++functionStats.switchTableCount;
 
             for (size_t i = 0; i < switchTable->second.labels.size(); i++)
             {
@@ -635,7 +1480,7 @@ bool Recompiler::Recompile(
         }
         else
         {
-            println("\tPPC_CALL_INDIRECT_FUNC({}.u32);", ctr());
+            printIndirectFunctionCall("");
             println("\treturn;");
         }
         break;
@@ -643,8 +1488,10 @@ bool Recompiler::Recompile(
     case PPC_INST_BCTRL:
         if (!config.skipLr)
             println("\tctx.lr = 0x{:X};", base + 4);
-        println("\tPPC_CALL_INDIRECT_FUNC({}.u32);", ctr());
+        printIndirectFunctionCall("");
         csrState = CSRState::Unknown; // the call could change it
+        if (config.guestPcMarkers)
+            println("\tPPC_SET_GUEST_PC(0x{:X});", base + 4);
         break;
 
     case PPC_INST_BDZ:
@@ -695,8 +1542,13 @@ bool Recompiler::Recompile(
     case PPC_INST_BL:
         if (!config.skipLr)
             println("\tctx.lr = 0x{:X};", base + 4);
-        printFunctionCall(insn.operands[0]);
-        csrState = CSRState::Unknown; // the call could change it
+        if (!RecompileInline(insn.operands[0], localVariables, csrState))
+        {
+            printFunctionCall(insn.operands[0]);
+            csrState = CSRState::Unknown; // the call could change it
+        }
+        if (config.guestPcMarkers)
+            println("\tPPC_SET_GUEST_PC(0x{:X});", base + 4);
         break;
 
     case PPC_INST_BLE:
@@ -729,7 +1581,7 @@ bool Recompiler::Recompile(
 
     case PPC_INST_BNECTR:
         println("\tif (!{}.eq) {{", cr(insn.operands[0]));
-        println("\t\tPPC_CALL_INDIRECT_FUNC({}.u32);", ctr());
+        printIndirectFunctionCall("\t");
         println("\t\treturn;");
         println("\t}}");
         break;
@@ -748,6 +1600,8 @@ bool Recompiler::Recompile(
 
     case PPC_INST_CLRLDI:
         println("\t{}.u64 = {}.u64 & 0x{:X};", r(insn.operands[0]), r(insn.operands[1]), (1ull << (64 - insn.operands[2])) - 1);
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_CLRLWI:
@@ -1232,11 +2086,38 @@ bool Recompiler::Recompile(
         println("{}.u32);", r(insn.operands[2]));
         break;
 
+    case PPC_INST_MFOCRF:
+    {
+        // Only one field is selected, the other bits are undefined. Selecting no field or several of them
+        // is undefined as a whole, so every field is copied the same way mfcr does.
+        uint32_t fieldMask = insn.operands[1];
+        if (fieldMask != 0 && fieldMask <= 0xFF && (fieldMask & (fieldMask - 1)) == 0)
+        {
+            size_t field = 0;
+            while ((fieldMask & (0x80 >> field)) == 0)
+                field++;
+
+            size_t shift = 28 - field * 4;
+            println("\t{}.u64 = (uint32_t({}.lt) << {}) | (uint32_t({}.gt) << {}) | (uint32_t({}.eq) << {}) | (uint32_t({}.so) << {});", r(insn.operands[0]), 
+                cr(field), shift + 3, cr(field), shift + 2, cr(field), shift + 1, cr(field), shift);
+            break;
+        }
+
+        [[fallthrough]];
+    }
+
     case PPC_INST_MFCR:
-        for (size_t i = 0; i < 32; i++)
+        if (config.packedCrRegisters && !config.crRegistersAsLocalVariables)
         {
-            constexpr std::string_view fields[] = { "lt", "gt", "eq", "so" };
-            println("\t{}.u64 {}= {}.{} ? 0x{:X} : 0;", r(insn.operands[0]), i == 0 ? "" : "|", cr(i / 4), fields[i % 4], 1u << (31 - i));
+            println("\t{}.u64 = ctx.cr.get();", r(insn.operands[0]));
+        }
+        else
+        {
+            for (size_t i = 0; i < 32; i++)
+            {
+                constexpr std::string_view fields[] = { "lt", "gt", "eq", "so" };
+                println("\t{}.u64 {}= {}.{} ? 0x{:X} : 0;", r(insn.operands[0]), i == 0 ? "" : "|", cr(i / 4), fields[i % 4], 1u << (31 - i));
+            }
         }
         break;
 
@@ -1254,28 +2135,40 @@ bool Recompiler::Recompile(
             println("\t{}.u64 = ctx.msr;", r(insn.operands[0]));
         break;
 
-    case PPC_INST_MFOCRF:
-        // TODO: don't hardcode to cr6
-        println("\t{}.u64 = ({}.lt << 7) | ({}.gt << 6) | ({}.eq << 5) | ({}.so << 4);", r(insn.operands[0]), cr(6), cr(6), cr(6), cr(6));
-        break;
-
     case PPC_INST_MFTB:
         println("\t{}.u64 = __rdtsc();", r(insn.operands[0]));
         break;
 
     case PPC_INST_MR:
-        println("\t{}.u64 = {}.u64;", r(insn.operands[0]), r(insn.operands[1]));
+        println("\t{}.u64 = {}.{};", r(insn.operands[0]), r(insn.operands[1]), narrow ? "u32" : "u64");
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_MTCR:
-        for (size_t i = 0; i < 32; i++)
+    case PPC_INST_MTCRF:
+    case PPC_INST_MTOCRF:
+    {
+        uint32_t fieldMask = insn.opcode->id == PPC_INST_MTCR ? 0xFF : insn.operands[0];
+        uint32_t source = insn.opcode->id == PPC_INST_MTCR ? insn.operands[0] : insn.operands[1];
+
+        if (config.packedCrRegisters && !config.crRegistersAsLocalVariables)
+        {
+            println("\tctx.cr.set({}.u32, 0x{:X});", r(source), fieldMask);
+        }
+        else
         {
-            constexpr std::string_view fields[] = { "lt", "gt", "eq", "so" };
-            println("\t{}.{} = ({}.u32 & 0x{:X}) != 0;", cr(i / 4), fields[i % 4], r(insn.operands[0]), 1u << (31 - i));
+            for (size_t i = 0; i < 32; i++)
+            {
+                if ((fieldMask & (0x80 >> (i / 4))) == 0)
+                    continue;
+
+                constexpr std::string_view fields[] = { "lt", "gt", "eq", "so" };
+                println("\t{}.{} = ({}.u32 & 0x{:X}) != 0;", cr(i / 4), fields[i % 4], r(source), 1u << (31 - i));
+            }
         }
         break;
+    }
 
     case PPC_INST_MTCTR:
         println("\t{}.u64 = {}.u64;", ctr(), r(insn.operands[0]));
@@ -1316,21 +2209,33 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_MULLI:
-        println("\t{}.s64 = {}.s64 * {};", r(insn.operands[0]), r(insn.operands[1]), int32_t(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 * {};", r(insn.operands[0]), r(insn.operands[1]), int32_t(insn.operands[2]));
+        else
+            println("\t{}.s64 = {}.s64 * {};", r(insn.operands[0]), r(insn.operands[1]), int32_t(insn.operands[2]));
         break;
 
     case PPC_INST_MULLW:
-        println("\t{}.s64 = int64_t({}.s32) * int64_t({}.s32);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 * {}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.s64 = int64_t({}.s32) * int64_t({}.s32);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_NAND:
-        println("\t{}.u64 = ~({}.u64 & {}.u64);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = ~({}.u32 & {}.u32);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = ~({}.u64 & {}.u64);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         break;
 
     case PPC_INST_NEG:
-        println("\t{}.s64 = -{}.s64;", r(insn.operands[0]), r(insn.operands[1]));
+        if (narrow)
+            println("\t{}.u64 = 0 - {}.u32;", r(insn.operands[0]), r(insn.operands[1]));
+        else
+            println("\t{}.s64 = -{}.s64;", r(insn.operands[0]), r(insn.operands[1]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
@@ -1340,63 +2245,104 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_NOR:
-        println("\t{}.u64 = ~({}.u64 | {}.u64);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = ~({}.u32 | {}.u32);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = ~({}.u64 | {}.u64);", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         break;
 
     case PPC_INST_NOT:
-        println("\t{}.u64 = ~{}.u64;", r(insn.operands[0]), r(insn.operands[1]));
+        println("\t{}.u64 = ~{}.{};", r(insn.operands[0]), r(insn.operands[1]), narrow ? "u32" : "u64");
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_OR:
-        println("\t{}.u64 = {}.u64 | {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 | {}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = {}.u64 | {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_ORC:
-        println("\t{}.u64 = {}.u64 | ~{}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 | ~{}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = {}.u64 | ~{}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         break;
 
     case PPC_INST_ORI:
-        println("\t{}.u64 = {}.u64 | {};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2]);
+        println("\t{}.u64 = {}.{} | {};", r(insn.operands[0]), r(insn.operands[1]), narrow ? "u32" : "u64", insn.operands[2]);
         break;
 
     case PPC_INST_ORIS:
-        println("\t{}.u64 = {}.u64 | {};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2] << 16);
+        println("\t{}.u64 = {}.{} | {};", r(insn.operands[0]), r(insn.operands[1]), narrow ? "u32" : "u64", insn.operands[2] << 16);
+        break;
+
+    case PPC_INST_RLDIC:
+    {
+        const uint64_t mask = ComputeMask(insn.operands[3], ~insn.operands[2]);
+        if (insn.operands[3] <= 63 - insn.operands[2])
+            println("\t{}.u64 = {};", r(insn.operands[0]), RotateAndMask(fmt::format("{}.u64", r(insn.operands[1])), 64, insn.operands[2], mask));
+        else
+            println("\t{}.u64 = __builtin_rotateleft64({}.u64, {}) & 0x{:X};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2], mask);
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
+    }
 
     case PPC_INST_RLDICL:
-        println("\t{}.u64 = __builtin_rotateleft64({}.u64, {}) & 0x{:X};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2], ComputeMask(insn.operands[3], 63));
+        println("\t{}.u64 = {};", r(insn.operands[0]), RotateAndMask(fmt::format("{}.u64", r(insn.operands[1])), 64, insn.operands[2], ComputeMask(insn.operands[3], 63)));
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_RLDICR:
-        println("\t{}.u64 = __builtin_rotateleft64({}.u64, {}) & 0x{:X};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2], ComputeMask(0, insn.operands[3]));
+        println("\t{}.u64 = {};", r(insn.operands[0]), RotateAndMask(fmt::format("{}.u64", r(insn.operands[1])), 64, insn.operands[2], ComputeMask(0, insn.operands[3])));
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_RLDIMI:
     {
         const uint64_t mask = ComputeMask(insn.operands[3], ~insn.operands[2]);
-        println("\t{}.u64 = (__builtin_rotateleft64({}.u64, {}) & 0x{:X}) | ({}.u64 & 0x{:X});", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2], mask, r(insn.operands[0]), ~mask);
+        if (insn.operands[3] <= 63 - insn.operands[2])
+            println("\t{}.u64 = ({}) | ({}.u64 & 0x{:X});", r(insn.operands[0]), RotateAndMask(fmt::format("{}.u64", r(insn.operands[1])), 64, insn.operands[2], mask), r(insn.operands[0]), ~mask);
+        else
+            println("\t{}.u64 = (__builtin_rotateleft64({}.u64, {}) & 0x{:X}) | ({}.u64 & 0x{:X});", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2], mask, r(insn.operands[0]), ~mask);
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
     }
 
     case PPC_INST_RLWIMI:
     {
+        // The rotated value is the low word duplicated in both halves, which only matters when the mask wraps around.
         const uint64_t mask = ComputeMask(insn.operands[3] + 32, insn.operands[4] + 32);
-        println("\t{}.u64 = (__builtin_rotateleft32({}.u32, {}) & 0x{:X}) | ({}.u64 & 0x{:X});", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2], mask, r(insn.operands[0]), ~mask);
+        if (insn.operands[3] <= insn.operands[4])
+            println("\t{}.u64 = ({}) | ({}.u64 & 0x{:X});", r(insn.operands[0]), RotateAndMask(fmt::format("{}.u32", r(insn.operands[1])), 32, insn.operands[2], mask), r(insn.operands[0]), ~mask);
+        else
+            println("\t{}.u64 = (__builtin_rotateleft64({}.u32 | ({}.u64 << 32), {}) & 0x{:X}) | ({}.u64 & 0x{:X});", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[1]), insn.operands[2], mask, r(insn.operands[0]), ~mask);
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
     }
 
     case PPC_INST_RLWINM:
-        println("\t{}.u64 = __builtin_rotateleft64({}.u32 | ({}.u64 << 32), {}) & 0x{:X};", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[1]), insn.operands[2], ComputeMask(insn.operands[3] + 32, insn.operands[4] + 32));
+        if (insn.operands[3] <= insn.operands[4])
+            println("\t{}.u64 = {};", r(insn.operands[0]), RotateAndMask(fmt::format("{}.u32", r(insn.operands[1])), 32, insn.operands[2], ComputeMask(insn.operands[3] + 32, insn.operands[4] + 32)));
+        else
+            println("\t{}.u64 = __builtin_rotateleft64({}.u32 | ({}.u64 << 32), {}) & 0x{:X};", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[1]), insn.operands[2], ComputeMask(insn.operands[3] + 32, insn.operands[4] + 32));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_ROTLDI:
         println("\t{}.u64 = __builtin_rotateleft64({}.u64, {});", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2]);
+        if (strchr(insn.opcode->name, '.'))
+            println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_ROTLW:
@@ -1685,7 +2631,10 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_SUBF:
-        println("\t{}.s64 = {}.s64 - {}.s64;", r(insn.operands[0]), r(insn.operands[2]), r(insn.operands[1]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 - {}.u32;", r(insn.operands[0]), r(insn.operands[2]), r(insn.operands[1]));
+        else
+            println("\t{}.s64 = {}.s64 - {}.s64;", r(insn.operands[0]), r(insn.operands[2]), r(insn.operands[1]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
@@ -2104,9 +3053,7 @@ bool Recompiler::Recompile(
 
     case PPC_INST_VSLW:
     case PPC_INST_VSLW128:
-        // TODO: vectorize, ensure endianness is correct
-        for (size_t i = 0; i < 4; i++)
-            println("\t{}.u32[{}] = {}.u32[{}] << ({}.u8[{}] & 0x1F);", v(insn.operands[0]), i, v(insn.operands[1]), i, v(insn.operands[2]), i * 4);
+        println("\t_mm_store_si128((__m128i*){}.u32, _mm_vslw(_mm_load_si128((__m128i*){}.u32), _mm_load_si128((__m128i*){}.u32)));", v(insn.operands[0]), v(insn.operands[1]), v(insn.operands[2]));
         break;
 
     case PPC_INST_VSPLTB:
@@ -2151,16 +3098,12 @@ bool Recompiler::Recompile(
 
     case PPC_INST_VSRAW:
     case PPC_INST_VSRAW128:
-        // TODO: vectorize, ensure endianness is correct
-        for (size_t i = 0; i < 4; i++)
-            println("\t{}.s32[{}] = {}.s32[{}] >> ({}.u8[{}] & 0x1F);", v(insn.operands[0]), i, v(insn.operands[1]), i, v(insn.operands[2]), i * 4);
+        println("\t_mm_store_si128((__m128i*){}.s32, _mm_vsraw(_mm_load_si128((__m128i*){}.s32), _mm_load_si128((__m128i*){}.u32)));", v(insn.operands[0]), v(insn.operands[1]), v(insn.operands[2]));
         break;
 
     case PPC_INST_VSRW:
     case PPC_INST_VSRW128:
-        // TODO: vectorize, ensure endianness is correct
-        for (size_t i = 0; i < 4; i++)
-            println("\t{}.u32[{}] = {}.u32[{}] >> ({}.u8[{}] & 0x1F);", v(insn.operands[0]), i, v(insn.operands[1]), i, v(insn.operands[2]), i * 4);
+        println("\t_mm_store_si128((__m128i*){}.u32, _mm_vsrw(_mm_load_si128((__m128i*){}.u32), _mm_load_si128((__m128i*){}.u32)));", v(insn.operands[0]), v(insn.operands[1]), v(insn.operands[2]));
         break;
 
     case PPC_INST_VSUBFP:
@@ -2250,17 +3193,20 @@ bool Recompiler::Recompile(
         break;
 
     case PPC_INST_XOR:
-        println("\t{}.u64 = {}.u64 ^ {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        if (narrow)
+            println("\t{}.u64 = {}.u32 ^ {}.u32;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
+        else
+            println("\t{}.u64 = {}.u64 ^ {}.u64;", r(insn.operands[0]), r(insn.operands[1]), r(insn.operands[2]));
         if (strchr(insn.opcode->name, '.'))
             println("\t{}.compare<int32_t>({}.s32, 0, {});", cr(0), r(insn.operands[0]), xer());
         break;
 
     case PPC_INST_XORI:
-        println("\t{}.u64 = {}.u64 ^ {};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2]);
+        println("\t{}.u64 = {}.{} ^ {};", r(insn.operands[0]), r(insn.operands[1]), narrow ? "u32" : "u64", insn.operands[2]);
         break;
 
     case PPC_INST_XORIS:
-        println("\t{}.u64 = {}.u64 ^ {};", r(insn.operands[0]), r(insn.operands[1]), insn.operands[2] << 16);
+        println("\t{}.u64 = {}.{} ^ {};", r(insn.operands[0]), r(insn.operands[1]), narrow ? "u32" : "u64", insn.operands[2] << 16);
         break;
 
     default:
@@ -2282,12 +3228,135 @@ bool Recompiler::Recompile(
     return true;
 }
 
+bool Recompiler::CanInline(size_t address)
+{
+    // Inlined functions don't count their entries.
+    if (config.inlineInstructionBudget == 0 || config.profileInstrumentation)
+        return false;
+
+    auto findResult = inlineCandidates.find(address);
+    if (findResult != inlineCandidates.end())
+        return findResult->second;
+
+    auto canInline = [&]()
+        {
+            auto symbol = image.symbols.find(address);
+            if (symbol == image.symbols.end() || symbol->address != address || symbol->type != Symbol_Function ||
+                symbol->size == 0 || symbol->size / 4 > config.inlineInstructionBudget + 1)
+            {
+                return false;
+            }
+
+            // Calls to these are handled separately.
+            if (address == config.longJmpAddress || address == config.setJmpAddress || 
+                (config.nonVolatileRegistersAsLocalVariables && (symbol->name.find("__rest") == 0 || symbol->name.find("__save") == 0)))
+            {
+                return false;
+            }
+
+            if (config.noInlineFunctions.find(address) != config.noInlineFunctions.end())
+                return false;
+
+            auto* data = (const uint32_t*)image.Find(address);
+            if (data == nullptr)
+                return false;
+
+            Function fn(address, symbol->size);
+            auto switchTable = config.switchTables.end();
+            RecompilerLocalVariables localVariables;
+            CSRState csrState = CSRState::Unknown;
+            bool result = true;
+
+            // Recompile the body without keeping the output or the statistics to make sure every instruction is supported.
+            std::string tempString;
+            std::swap(out, tempString);
+            RecompilerFunctionStats tempStats;
+            std::swap(functionStats, tempStats);
+
+            ppc_insn insn;
+            for (size_t base = address; base < address + symbol->size && result; base += 4, ++data)
+            {
+                if (config.switchTables.find(base) != config.switchTables.end() ||
+                    config.midAsmHooks.find(base) != config.midAsmHooks.end() ||
+                    config.indirectCalls.find(base) != config.indirectCalls.end())
+                {
+                    result = false;
+                    break;
+                }
+
+                ppc::Disassemble(data, 4, base, insn);
+                if (insn.opcode == nullptr)
+                {
+                    result = false;
+                    break;
+                }
+
+                // Only the last instruction can be a branch, and it has to be a return.
+                if (base + 4 == address + symbol->size)
+                {
+                    result = insn.opcode->id == PPC_INST_BLR;
+                    break;
+                }
+
+                uint32_t instruction = ByteSwap(*data);
+                uint32_t op = PPC_OP(instruction);
+                uint32_t xop = PPC_XOP(instruction);
+                if (op == PPC_OP_B || op == PPC_OP_BC || (op == PPC_OP_CTR && (xop == 16 || xop == 528)) ||
+                    insn.opcode->id == PPC_INST_MFLR || insn.opcode->id == PPC_INST_MTLR)
+                {
+                    result = false;
+                    break;
+                }
+
+                result = Recompile(fn, base, insn, data, switchTable, localVariables, csrState);
+            }
+
+            std::swap(out, tempString);
+            std::swap(functionStats, tempStats);
+            return result;
+        };
+
+    bool result = canInline();
+    inlineCandidates.emplace(address, result);
+    return result;
+}
+
+bool Recompiler::RecompileInline(size_t address, RecompilerLocalVariables& localVariables, CSRState& csrState)
+{
+    if (!CanInline(address))
+        return false;
+
+    auto symbol = image.symbols.find(address);
+    auto* data = (const uint32_t*)image.Find(address);
+    Function fn(address, symbol->size);
+    auto switchTable = config.switchTables.end();
+
+    println("\t// inlined {}", symbol->name);
+
+    // The callee shares the local variables of the caller. This is fine as the callee
+    // can only modify volatile registers, which the caller cannot expect to be preserved.
+    ppc_insn insn;
+    for (size_t base = address; base + 4 < address + symbol->size; base += 4, ++data)
+    {
+        ppc::Disassemble(data, 4, base, insn);
+        Recompile(fn, base, insn, data, switchTable, localVariables, csrState);
+    }
+
+    return true;
+}
+
 bool Recompiler::Recompile(const Function& fn)
 {
     auto base = fn.base;
     auto end = base + fn.size;
     auto* data = (uint32_t*)image.Find(base);
 
+    functionStats = {};
+    functionStats.address = fn.base;
+    functionStats.size = fn.size;
+    functionStats.blockCount = 1;
+    size_t outStart = out.size();
+
     static std::unordered_set<size_t> labels;
     labels.clear();
 
@@ -2313,6 +3382,10 @@ bool Recompiler::Recompile(const Function& fn)
         auto midAsmHook = config.midAsmHooks.find(addr);
         if (midAsmHook != config.midAsmHooks.end())
         {
+            // Hooks are implemented once, outside of the ISA level namespaces.
+            if (!config.isaLevels.empty())
+                println("PPC_ISA_NAMESPACE_END");
+
             if (midAsmHook->second.returnOnFalse || midAsmHook->second.returnOnTrue ||
                 midAsmHook->second.jumpAddressOnFalse != NULL || midAsmHook->second.jumpAddressOnTrue != NULL)
             {
@@ -2361,6 +3434,9 @@ bool Recompiler::Recompile(const Function& fn)
 
             println(");\n");
 
+            if (!config.isaLevels.empty())
+                println("PPC_ISA_NAMESPACE_BEGIN\n");
+
             if (midAsmHook->second.jumpAddress != NULL)
                 labels.emplace(midAsmHook->second.jumpAddress);       
             if (midAsmHook->second.jumpAddressOnTrue != NULL)
@@ -2381,13 +3457,37 @@ bool Recompiler::Recompile(const Function& fn)
         name = fmt::format("sub_{}", fn.base);
     }
 
+    // Aliases refer to the implementation function by its C name, which it doesn't have inside an ISA level namespace.
 #ifdef XENON_RECOMP_USE_ALIAS
-    println("__attribute__((alias(\"__imp__{}\"))) PPC_WEAK_FUNC({});", name, name);
+    const bool useAlias = config.isaLevels.empty();
+#else
+    const bool useAlias = false;
 #endif
 
-    println("PPC_FUNC_IMPL(__imp__{}) {{", name);
+    if (useAlias)
+        println("__attribute__((alias(\"__imp__{}\"))) PPC_WEAK_FUNC({});", name, name);
+
+    if (hotFunctions.find(fn.base) != hotFunctions.end())
+        println("PPC_HOT_FUNC_IMPL(__imp__{}) {{", name);
+    else if (coldFunctions.find(fn.base) != coldFunctions.end())
+        println("PPC_COLD_FUNC_IMPL(__imp__{}) {{", name);
+    else
+        println("PPC_FUNC_IMPL(__imp__{}) {{", name);
+
     println("\tPPC_FUNC_PROLOGUE();");
 
+    if (config.profileInstrumentation)
+    {
+        println("\tPPC_PROFILE_FUNC({});", profileFunctions.size());
+        profileFunctions.push_back(fn.base);
+    }
+
+    if (config.guestPcMarkers)
+        println("\tPPC_SET_GUEST_PC(0x{:X});", fn.base);
+
+    if (config.narrowIntegerOperations)
+        AnalyseOperandWidths(fn);
+
     auto switchTable = config.switchTables.end();
     bool allRecompiled = true;
     CSRState csrState = CSRState::Unknown;
@@ -2405,6 +3505,18 @@ bool Recompiler::Recompile(const Function& fn)
         {
             println("loc_{:X}:", base);
 
+            if (base != fn.base)
+                ++functionStats.blockCount;
+
+            if (config.profileInstrumentation && config.profileBlocks)
+            {
+                println("\tPPC_PROFILE_BLOCK({});", profileBlocks.size());
+                profileBlocks.push_back(base);
+            }
+
+            if (config.guestPcMarkers)
+                println("\tPPC_SET_GUEST_PC(0x{:X});", base);
+
             // Anyone could jump to this label so we wouldn't know what the CSR state would be.
             csrState = CSRState::Unknown;
         }
@@ -2417,10 +3529,14 @@ bool Recompiler::Recompile(const Function& fn)
         if (insn.opcode == nullptr)
         {
             println("\t// {}", insn.op_str);
-#if 1
+
             if (*data != 0)
+            {
+                ++functionStats.unrecognizedInstructionCount;
+#if 1
                 fmt::println("Unable to decode instruction {:X} at {:X}", *data, base);
 #endif
+            }
         }
         else
         {
@@ -2431,6 +3547,7 @@ bool Recompiler::Recompile(const Function& fn)
             {
                 fmt::println("Unrecognized instruction at 0x{:X}: {}", base, insn.opcode->name);
                 allRecompiled = false;
+                ++functionStats.unrecognizedInstructionCount;
             }
         }
 
@@ -2445,11 +3562,12 @@ bool Recompiler::Recompile(const Function& fn)
 
     println("}}\n");
 
-#ifndef XENON_RECOMP_USE_ALIAS
-    println("PPC_WEAK_FUNC({}) {{", name);
-    println("\t__imp__{}(ctx, base);", name);
-    println("}}\n");
-#endif
+    if (!useAlias)
+    {
+        println("PPC_WEAK_FUNC({}) {{", name);
+        println("\t__imp__{}(ctx, base);", name);
+        println("}}\n");
+    }
 
     std::swap(out, tempString);
     if (localVariables.ctr)
@@ -2497,13 +3615,63 @@ bool Recompiler::Recompile(const Function& fn)
 
     out += tempString;
 
+    // Identical functions share the implementation, but keep their own weak function for hooking.
+    auto duplicates = duplicateFunctions.find(fn.base);
+    if (duplicates != duplicateFunctions.end())
+    {
+        for (auto address : duplicates->second)
+        {
+            auto duplicateName = image.symbols.find(address)->name;
+
+            if (useAlias)
+            {
+                println("__attribute__((alias(\"__imp__{}\"))) PPC_WEAK_FUNC({});", duplicateName, duplicateName);
+                println("__attribute__((alias(\"__imp__{}\"))) PPC_FUNC_IMPL(__imp__{});\n", name, duplicateName);
+            }
+            else
+            {
+                println("PPC_FUNC_IMPL(__imp__{}) {{", duplicateName);
+                println("\t__imp__{}(ctx, base);", name);
+                println("}}\n");
+
+                println("PPC_WEAK_FUNC({}) {{", duplicateName);
+                println("\t__imp__{}(ctx, base);", name);
+                println("}}\n");
+            }
+        }
+    }
+
+    if (!config.functionReportFilePath.empty())
+    {
+        functionStats.name = name;
+        functionStats.outputBytes = out.size() - outStart;
+        stats.functions.push_back(functionStats);
+    }
+
     return allRecompiled;
 }
 
 void Recompiler::Recompile(const std::filesystem::path& headerFilePath)
 {
+    RecompilerStats::Scope scope(stats, "Recompile");
     out.reserve(10 * 1024 * 1024);
 
+    // Extract the address of the minimum code segment to store the function table at.
+    size_t codeMin = ~0;
+    size_t codeMax = 0;
+
+    for (auto& section : image.sections)
+    {
+        if ((section.flags & SectionFlags_Code) != 0)
+        {
+            if (section.base < codeMin)
+                codeMin = section.base;
+
+            if ((section.base + section.size) > codeMax)
+                codeMax = (section.base + section.size);
+        }
+    }
+
     {
         println("#pragma once");
 
@@ -2526,28 +3694,23 @@ void Recompiler::Recompile(const std::filesystem::path& headerFilePath)
             println("#define PPC_CONFIG_NON_ARGUMENT_AS_LOCAL");   
         if (config.nonVolatileRegistersAsLocalVariables)
             println("#define PPC_CONFIG_NON_VOLATILE_AS_LOCAL");
+        if (config.packedCrRegisters)
+            println("#define PPC_CONFIG_PACKED_CR");
+        if (config.profileInstrumentation)
+            println("#define PPC_CONFIG_PROFILE");
+        if (config.guestPcMarkers)
+            println("#define PPC_CONFIG_GUEST_PC");
+        if (!config.isaLevels.empty())
+            println("#define PPC_CONFIG_MULTI_ISA");
+        if (config.sparseFunctionTable)
+            println("#define PPC_CONFIG_SPARSE_FUNC_TABLE");
+        if (config.functionTableBlob)
+            println("#define PPC_CONFIG_FUNC_TABLE_BLOB");
 
         println("");
 
         println("#define PPC_IMAGE_BASE 0x{:X}ull", image.base);
         println("#define PPC_IMAGE_SIZE 0x{:X}ull", image.size);
-        
-        // Extract the address of the minimum code segment to store the function table at.
-        size_t codeMin = ~0;
-        size_t codeMax = 0;
-
-        for (auto& section : image.sections)
-        {
-            if ((section.flags & SectionFlags_Code) != 0)
-            {
-                if (section.base < codeMin)
-                    codeMin = section.base;
-
-                if ((section.base + section.size) > codeMax)
-                    codeMax = (section.base + section.size);
-            }
-        }
-
         println("#define PPC_CODE_BASE 0x{:X}ull", codeMin);
         println("#define PPC_CODE_SIZE 0x{:X}ull", codeMax - codeMin);
 
@@ -2583,15 +3746,41 @@ void Recompiler::Recompile(const std::filesystem::path& headerFilePath)
         println("#include \"ppc_config.h\"");
         println("#include \"ppc_context.h\"\n");
 
+        if (!config.isaLevels.empty())
+            println("PPC_ISA_NAMESPACE_BEGIN\n");
+
         for (auto& symbol : image.symbols)
             println("PPC_EXTERN_FUNC({});", symbol.name);
 
+        if (!config.isaLevels.empty())
+            println("\nPPC_ISA_NAMESPACE_END");
+
         SaveCurrentOutData("ppc_recomp_shared.h");
     }
 
+    // The entries of the sparse function table in address order. Like when filling the flat table
+    // from the mappings, the last symbol at an address takes precedence.
+    std::vector<const Symbol*> tableSymbols;
+    if (config.sparseFunctionTable)
+    {
+        for (auto& symbol : image.symbols)
+        {
+            if (symbol.address >= codeMin && symbol.address < codeMax)
+            {
+                if (!tableSymbols.empty() && tableSymbols.back()->address == symbol.address)
+                    tableSymbols.back() = &symbol;
+                else
+                    tableSymbols.push_back(&symbol);
+            }
+        }
+    }
+
     {
         println("#include \"ppc_recomp_shared.h\"\n");
 
+        if (!config.isaLevels.empty())
+            println("PPC_ISA_NAMESPACE_BEGIN\n");
+
         println("PPCFuncMapping PPCFuncMappings[] = {{");
         for (auto& symbol : image.symbols)
             println("\t{{ 0x{:X}, {} }},", symbol.address, symbol.name);
@@ -2599,30 +3788,361 @@ void Recompiler::Recompile(const std::filesystem::path& headerFilePath)
         println("\t{{ 0, nullptr }}");
         println("}};");
 
+        if (config.sparseFunctionTable)
+        {
+            // The first entry is shared by every address that is not a function entry.
+            println("\nPPCFunc* PPCFuncTable[] = {{");
+            println("\tnullptr,");
+            for (auto symbol : tableSymbols)
+                println("\t{},", symbol->name);
+
+            println("}};");
+        }
+
+        if (!config.isaLevels.empty())
+            println("\nPPC_ISA_NAMESPACE_END");
+
         SaveCurrentOutData("ppc_func_mapping.cpp");
     }
 
-    for (size_t i = 0; i < functions.size(); i++)
+    if (config.sparseFunctionTable)
     {
-        if ((i % 256) == 0)
+        // One bit for every instruction in the code sections, set at function entries.
+        std::vector<uint64_t> bitmap(((codeMax - codeMin) / 4 + 63) / 64);
+        std::vector<uint32_t> ranks(bitmap.size());
+
+        for (auto symbol : tableSymbols)
         {
-            SaveCurrentOutData();
-            println("#include \"ppc_recomp_shared.h\"\n");
+            size_t index = (symbol->address - codeMin) / 4;
+            bitmap[index / 64] |= 1ull << (index % 64);
+        }
+
+        for (size_t i = 1; i < bitmap.size(); i++)
+            ranks[i] = ranks[i - 1] + __builtin_popcountll(bitmap[i - 1]);
+
+        println("#include \"ppc_config.h\"");
+        println("#include \"ppc_context.h\"\n");
+
+        if (config.functionTableBlob)
+        {
+            // "PPFT" in little endian.
+            constexpr uint32_t c_funcTableBlobMagic = 0x54465050;
+
+            println("#ifdef PPC_CONFIG_FUNC_TABLE_BLOB\n");
+
+            println("#ifdef _WIN32");
+            println("#include <windows.h>");
+            println("#else");
+            println("#include <fcntl.h>");
+            println("#include <sys/mman.h>");
+            println("#include <sys/stat.h>");
+            println("#include <unistd.h>");
+            println("#endif\n");
+
+            println("const uint64_t* PPCFuncBitmap;");
+            println("const uint32_t* PPCFuncRanks;\n");
+
+            println("bool PPCFuncTableLoad(const char* path)");
+            println("{{");
+            println("\tconstexpr size_t wordCount = {};", bitmap.size());
+            println("\tconstexpr size_t fileSize = 0x10 + wordCount * (sizeof(uint64_t) + sizeof(uint32_t));\n");
+
+            println("#ifdef _WIN32");
+            println("\tHANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);");
+            println("\tif (file == INVALID_HANDLE_VALUE)");
+            println("\t\treturn false;\n");
+            println("\tLARGE_INTEGER size{{}};");
+            println("\tHANDLE mapping = nullptr;");
+            println("\tif (GetFileSizeEx(file, &size) && size.QuadPart == fileSize)");
+            println("\t\tmapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);\n");
+            println("\tCloseHandle(file);");
+            println("\tif (mapping == nullptr)");
+            println("\t\treturn false;\n");
+            println("\tvoid* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);");
+            println("\tCloseHandle(mapping);");
+            println("\tif (view == nullptr)");
+            println("\t\treturn false;");
+            println("#else");
+            println("\tint fd = open(path, O_RDONLY);");
+            println("\tif (fd == -1)");
+            println("\t\treturn false;\n");
+            println("\tstruct stat st;");
+            println("\tvoid* view = MAP_FAILED;");
+            println("\tif (fstat(fd, &st) == 0 && st.st_size == fileSize)");
+            println("\t\tview = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);\n");
+            println("\tclose(fd);");
+            println("\tif (view == MAP_FAILED)");
+            println("\t\treturn false;");
+            println("#endif\n");
+
+            // The header must match the one written by the recompiler below.
+            println("\tconst uint32_t* header = reinterpret_cast<const uint32_t*>(view);");
+            println("\tif (header[0] != 0x{:X} || header[1] != uint32_t(PPC_CODE_BASE) || header[2] != uint32_t(PPC_CODE_SIZE) || header[3] != {})",
+                c_funcTableBlobMagic, tableSymbols.size());
+            println("\t{{");
+            println("#ifdef _WIN32");
+            println("\t\tUnmapViewOfFile(view);");
+            println("#else");
+            println("\t\tmunmap(view, fileSize);");
+            println("#endif");
+            println("\t\treturn false;");
+            println("\t}}\n");
+
+            println("\tPPCFuncBitmap = reinterpret_cast<const uint64_t*>(header + 4);");
+            println("\tPPCFuncRanks = reinterpret_cast<const uint32_t*>(PPCFuncBitmap + wordCount);");
+            println("\treturn true;");
+            println("}}\n");
+
+            println("#endif");
+
+            SaveCurrentOutData("ppc_func_table.cpp");
+
+            // The bitmap and ranks are stored in the host byte order, as the runtime maps them as is.
+            uint32_t header[] = { c_funcTableBlobMagic, uint32_t(codeMin), uint32_t(codeMax - codeMin), uint32_t(tableSymbols.size()) };
+            out.append(reinterpret_cast<const char*>(header), sizeof(header));
+            out.append(reinterpret_cast<const char*>(bitmap.data()), bitmap.size() * sizeof(uint64_t));
+            out.append(reinterpret_cast<const char*>(ranks.data()), ranks.size() * sizeof(uint32_t));
+
+            SaveCurrentOutData("ppc_func_table.bin");
+        }
+        else
+        {
+            println("#ifdef PPC_CONFIG_SPARSE_FUNC_TABLE\n");
+
+            println("extern const uint64_t PPCFuncBitmap[] = {{");
+            for (size_t i = 0; i < bitmap.size(); i += 8)
+            {
+                print("\t");
+                for (size_t j = i; j < std::min(i + 8, bitmap.size()); j++)
+                    print("{}0x{:X},", j != i ? " " : "", bitmap[j]);
+
+                println("");
+            }
+            println("}};\n");
+
+            println("extern const uint32_t PPCFuncRanks[] = {{");
+            for (size_t i = 0; i < ranks.size(); i += 8)
+            {
+                print("\t");
+                for (size_t j = i; j < std::min(i + 8, ranks.size()); j++)
+                    print("{}{},", j != i ? " " : "", ranks[j]);
+
+                println("");
+            }
+            println("}};\n");
+
+            println("#endif");
+
+            SaveCurrentOutData("ppc_func_table.cpp");
+        }
+    }
+
+    if (!config.isaLevels.empty())
+    {
+        auto hasLevel = [&](const std::string_view& level)
+            {
+                return std::find(config.isaLevels.begin(), config.isaLevels.end(), level) != config.isaLevels.end();
+            };
+
+        // Picks the variable of the selected level, trying the levels from the best to the worst.
+        auto printSelect = [&](const std::string_view& type, const std::string_view& name)
+            {
+                print("{} {} = ", type, name);
+                for (auto level : { "avx512", "avx2" })
+                {
+                    if (hasLevel(level))
+                        print("PPCSelectedIsaLevel == PPCIsaLevel_{} ? ppc_isa_{}::{} : ", level, level, name);
+                }
+                println("ppc_isa_sse::{};", name);
+            };
+
+        println("#include \"ppc_config.h\"");
+        println("#include \"ppc_context.h\"\n");
+
+        for (auto& level : config.isaLevels)
+        {
+            if (config.sparseFunctionTable)
+                println("namespace ppc_isa_{} {{ extern PPCFuncMapping PPCFuncMappings[]; extern PPCFunc* PPCFuncTable[]; }}", level);
+            else
+                println("namespace ppc_isa_{} {{ extern PPCFuncMapping PPCFuncMappings[]; }}", level);
         }
 
+        println("");
+
+        println("enum PPCIsaLevel");
+        println("{{");
+        println("\tPPCIsaLevel_sse,");
+        println("\tPPCIsaLevel_avx2,");
+        println("\tPPCIsaLevel_avx512");
+        println("}};\n");
+
+        // Must match the target macros that pick the namespace in ppc_context.h.
+        println("static PPCIsaLevel PPCSelectIsaLevel()");
+        println("{{");
+        println("\t__builtin_cpu_init();\n");
+
+        if (hasLevel("avx512"))
+        {
+            println("\tif (__builtin_cpu_supports(\"avx512f\") && __builtin_cpu_supports(\"avx512vl\") && __builtin_cpu_supports(\"avx512bw\") && __builtin_cpu_supports(\"avx512dq\") &&");
+            println("\t\t__builtin_cpu_supports(\"avx512vbmi\") && __builtin_cpu_supports(\"avx512vbmi2\"))");
+            println("\t{{");
+            println("\t\treturn PPCIsaLevel_avx512;");
+            println("\t}}\n");
+        }
+
+        if (hasLevel("avx2"))
+        {
+            println("\tif (__builtin_cpu_supports(\"avx2\") && __builtin_cpu_supports(\"fma\") && __builtin_cpu_supports(\"bmi2\"))");
+            println("\t\treturn PPCIsaLevel_avx2;\n");
+        }
+
+        println("\treturn PPCIsaLevel_sse;");
+        println("}}\n");
+
+        println("static const PPCIsaLevel PPCSelectedIsaLevel = PPCSelectIsaLevel();\n");
+
+        printSelect("PPCFuncMapping*", "PPCFuncMappings");
+        if (config.sparseFunctionTable)
+            printSelect("PPCFunc**", "PPCFuncTable");
+
+        SaveCurrentOutData("ppc_isa_dispatch.cpp");
+    }
+
+    auto isHot = [&](size_t address) { return hotFunctions.find(address) != hotFunctions.end(); };
+    auto isCold = [&](size_t address) { return coldFunctions.find(address) != coldFunctions.end(); };
+
+    RecompilerTimer shardTimer;
+    size_t shardFunctionCount = 0;
+
+    // Declares only the functions called within the file instead of including ppc_recomp_shared.h,
+    // which declares every symbol and would otherwise have to be parsed again for every file.
+    auto saveShard = [&]()
+        {
+            std::string code;
+            std::swap(out, code);
+
+            println("#include \"ppc_config.h\"");
+            println("#include \"ppc_context.h\"\n");
+
+            if (!config.isaLevels.empty())
+                println("PPC_ISA_NAMESPACE_BEGIN\n");
+
+            for (auto& name : shardCallTargets)
+                println("PPC_EXTERN_FUNC({});", name);
+
+            if (!shardCallTargets.empty())
+                println("");
+
+            out += code;
+
+            if (!config.isaLevels.empty())
+                println("PPC_ISA_NAMESPACE_END");
+
+            stats.AddShard(fmt::format("ppc_recomp.{}.cpp", cppFileIndex), shardTimer, shardFunctionCount, out.size());
+
+            SaveCurrentOutData();
+            shardCallTargets.clear();
+
+            shardTimer = {};
+            shardFunctionCount = 0;
+        };
+
+    for (size_t i = 0; i < functions.size(); i++)
+    {
+        // Start a new file whenever the function temperature changes to not mix hot and cold code.
+        bool temperatureChanged = i != 0 &&
+            (isHot(functions[i].base) != isHot(functions[i - 1].base) || isCold(functions[i].base) != isCold(functions[i - 1].base));
+
+        if (i != 0 && ((shardFunctionCount % 256) == 0 || temperatureChanged))
+            saveShard();
+
         if ((i % 2048) == 0 || (i == (functions.size() - 1)))
             fmt::println("Recompiling functions... {}%", static_cast<float>(i + 1) / functions.size() * 100.0f);
 
         Recompile(functions[i]);
+        ++shardFunctionCount;
+    }
+
+    if (!functions.empty())
+        saveShard();
+
+    if (!config.functionReportFilePath.empty() && !stats.SaveFunctions(config.directoryPath + config.functionReportFilePath))
+        fmt::println("WARNING: Unable to save the function report");
+
+    if (config.profileInstrumentation)
+    {
+        println("#include \"ppc_config.h\"");
+        println("#include \"ppc_context.h\"");
+        println("#include <cstdio>\n");
+
+        println("#ifdef PPC_CONFIG_PROFILE\n");
+
+        println("uint64_t PPCProfileFuncCounters[{}];", std::max<size_t>(profileFunctions.size(), 1));
+        println("uint64_t PPCProfileBlockCounters[{}];", std::max<size_t>(profileBlocks.size(), 1));
+        println("uint64_t PPCProfileIndirectTargets[{}];", std::max<size_t>(profileIndirectCalls.size(), 1));
+        println("extern const size_t PPCProfileFuncCount = {};", profileFunctions.size());
+        println("extern const size_t PPCProfileBlockCount = {};", profileBlocks.size());
+        println("extern const size_t PPCProfileIndirectCount = {};\n", profileIndirectCalls.size());
+
+        println("bool PPCProfileSave(const char* path)");
+        println("{{");
+        println("\tFILE* f = fopen(path, \"wb\");");
+        println("\tif (f == nullptr)");
+        println("\t\treturn false;\n");
+        println("\tbool result = fwrite(PPCProfileFuncCounters, sizeof(uint64_t), PPCProfileFuncCount, f) == PPCProfileFuncCount &&");
+        println("\t\tfwrite(PPCProfileBlockCounters, sizeof(uint64_t), PPCProfileBlockCount, f) == PPCProfileBlockCount &&");
+        println("\t\tfwrite(PPCProfileIndirectTargets, sizeof(uint64_t), PPCProfileIndirectCount, f) == PPCProfileIndirectCount;\n");
+        println("\tfclose(f);");
+        println("\treturn result;");
+        println("}}\n");
+
+        println("#endif");
+
+        SaveCurrentOutData("ppc_profile.cpp");
+
+        println("# Maps the profile counter ordinals to guest addresses.");
+        println("functions = [");
+        for (auto address : profileFunctions)
+            println("    0x{:X},", address);
+        println("]\n");
+
+        println("blocks = [");
+        for (auto address : profileBlocks)
+            println("    0x{:X},", address);
+        println("]\n");
+
+        println("indirect_calls = [");
+        for (auto address : profileIndirectCalls)
+            println("    0x{:X},", address);
+        println("]");
+
+        SaveCurrentOutData("ppc_profile.toml");
     }
 
-    SaveCurrentOutData();
+    RecompilerStats::Scope flushScope(stats, "WaitForOutput");
+    outputWriter.Flush();
+
+    scope.items = functions.size();
+    flushScope.items = outputWriter.writtenFileCount;
+    flushScope.bytes = outputWriter.writtenByteCount;
+}
+
+void Recompiler::PrintStats()
+{
+    stats.Print();
+
+    if (!config.statsFilePath.empty() && !stats.Save(config.directoryPath + config.statsFilePath))
+        fmt::println("WARNING: Unable to save the stats file");
 }
 
 void Recompiler::SaveCurrentOutData(const std::string_view& name)
 {
     if (!out.empty())
     {
+        RecompilerStats::Scope scope(stats, "SaveCurrentOutData");
+        scope.items = 1;
+        scope.bytes = out.size();
+
         std::string cppName;
 
         if (name.empty())
@@ -2631,39 +4151,12 @@ void Recompiler::SaveCurrentOutData(const std::string_view& name)
             ++cppFileIndex;
         }
 
-        bool shouldWrite = true;
-
-        // Check if an identical file already exists first to not trigger recompilation
         std::string directoryPath = config.directoryPath;
         if (!directoryPath.empty())
             directoryPath += "/";
 
-        std::string filePath = fmt::format("{}{}/{}", directoryPath, config.outDirectoryPath, name.empty() ? cppName : name);
-        FILE* f = fopen(filePath.c_str(), "rb");
-        if (f)
-        {
-            static std::vector<uint8_t> temp;
-
-            fseek(f, 0, SEEK_END);
-            long fileSize = ftell(f);
-            if (fileSize == out.size())
-            {
-                fseek(f, 0, SEEK_SET);
-                temp.resize(fileSize);
-                fread(temp.data(), 1, fileSize, f);
-
-                shouldWrite = !XXH128_isEqual(XXH3_128bits(temp.data(), temp.size()), XXH3_128bits(out.data(), out.size()));
-            }
-            fclose(f);
-        }
-
-        if (shouldWrite)
-        {
-            f = fopen(filePath.c_str(), "wb");
-            fwrite(out.data(), 1, out.size(), f);
-            fclose(f);
-        }
-
+        // The writer takes the data over and skips identical files to not trigger recompilation.
+        outputWriter.Write(directoryPath + config.outDirectoryPath, name.empty() ? cppName : std::string(name), std::move(out));
         out.clear();
     }
 }
@@ -2,6 +2,8 @@
 
 #include "pch.h"
 #include "recompiler_config.h"
+#include "output_writer.h"
+#include "recompiler_stats.h"
 
 struct RecompilerLocalVariables
 {
@@ -29,14 +31,51 @@ struct Recompiler
 {
     // Enforce In-order Execution of I/O constant for quick comparison
     static constexpr uint32_t c_eieio = 0xAC06007C;
+    // Fraction of all profiled function entries that the hot set has to cover
+    static constexpr double c_hotFunctionCoverage = 0.99;
     Image image;
     std::vector<Function> functions;
     std::string out;
     size_t cppFileIndex = 0;
     RecompilerConfig config;
+    OutputWriter outputWriter;
+    RecompilerStats stats;
+
+    // Guest addresses of the emitted profile counters, indexed by ordinal
+    std::vector<size_t> profileFunctions;
+    std::vector<size_t> profileBlocks;
+    std::vector<size_t> profileIndirectCalls;
+
+    // Function entry counts loaded from a previously dumped profile
+    std::unordered_map<size_t, uint64_t> profileCounts;
+    std::unordered_set<size_t> hotFunctions;
+    std::unordered_set<size_t> coldFunctions;
+
+    // Functions not reachable from the entry point or any other root
+    std::unordered_set<size_t> unreachableFunctions;
+
+    // Addresses of the functions identical to each emitted function
+    std::unordered_map<size_t, std::vector<size_t>> duplicateFunctions;
+
+    // Whether the function at an address can be inlined into its callers
+    std::unordered_map<size_t, bool> inlineCandidates;
+
+    // Instructions of the current function whose result never has its upper half observed
+    std::unordered_set<size_t> narrowInstructions;
+
+    // General purpose registers observed in full after returning, one bit each. Following the ABI, r0 and r5-r12 are not.
+    uint32_t returnRegisters = ~0x1FE1u;
+
+    // Functions called from the current output file, which are declared at its start
+    std::set<std::string> shardCallTargets;
+
+    // Counts of what was emitted for the current function
+    RecompilerFunctionStats functionStats;
 
     bool LoadConfig(const std::string_view& configFilePath);
 
+    bool LoadProfile();
+
     template<class... Args>
     void print(fmt::format_string<Args...> fmt, Args&&... args)
     {
@@ -52,6 +91,14 @@ struct Recompiler
 
     void Analyse();
 
+    void AnalyseReachability();
+
+    void DeduplicateFunctions();
+
+    void ApplyProfile();
+
+    void AnalyseOperandWidths(const Function& fn);
+
     // TODO: make a RecompileArgs struct instead this is getting messy
     bool Recompile(
         const Function& fn,
@@ -62,9 +109,15 @@ struct Recompiler
         RecompilerLocalVariables& localVariables,
         CSRState& csrState);
 
+    bool CanInline(size_t address);
+
+    bool RecompileInline(size_t address, RecompilerLocalVariables& localVariables, CSRState& csrState);
+
     bool Recompile(const Function& fn);
 
     void Recompile(const std::filesystem::path& headerFilePath);
 
+    void PrintStats();
+
     void SaveCurrentOutData(const std::string_view& name = std::string_view());
 };
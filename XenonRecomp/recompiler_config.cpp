@@ -15,8 +15,15 @@ void RecompilerConfig::Load(const std::string_view& configFilePath)
         filePath = main["file_path"].value_or<std::string>("");
         patchFilePath = main["patch_file_path"].value_or<std::string>("");
         patchedFilePath = main["patched_file_path"].value_or<std::string>("");
+        imageCacheFilePath = main["image_cache_file_path"].value_or<std::string>("");
         outDirectoryPath = main["out_directory_path"].value_or<std::string>("");
         switchTableFilePath = main["switch_table_file_path"].value_or<std::string>("");
+        indirectCallFilePath = main["indirect_call_file_path"].value_or<std::string>("");
+        profileFilePath = main["profile_file_path"].value_or<std::string>("");
+        profileMapFilePath = main["profile_map_file_path"].value_or<std::string>("");
+        statsFilePath = main["stats_file_path"].value_or<std::string>("");
+        functionReportFilePath = main["function_report_file_path"].value_or<std::string>("");
+        skipHashVerification = main["skip_hash_verification"].value_or(false);
 
         skipLr = main["skip_lr"].value_or(false);
         skipMsr = main["skip_msr"].value_or(false);
@@ -26,6 +33,27 @@ void RecompilerConfig::Load(const std::string_view& configFilePath)
         crRegistersAsLocalVariables = main["cr_as_local"].value_or(false);
         nonArgumentRegistersAsLocalVariables = main["non_argument_as_local"].value_or(false);
         nonVolatileRegistersAsLocalVariables = main["non_volatile_as_local"].value_or(false);
+        packedCrRegisters = main["packed_cr"].value_or(false);
+        narrowIntegerOperations = main["narrow_integer_operations"].value_or(false);
+        profileInstrumentation = main["profile_instrumentation"].value_or(false);
+        profileBlocks = main["profile_blocks"].value_or(false);
+        guestPcMarkers = main["guest_pc_markers"].value_or(false);
+        deduplicateFunctions = main["deduplicate_functions"].value_or(false);
+        inlineInstructionBudget = main["inline_instruction_budget"].value_or(0u);
+        sparseFunctionTable = main["sparse_function_table"].value_or(false);
+        functionTableBlob = main["function_table_blob"].value_or(false);
+
+        // The blob stores the index of the sparse table, so it requires it.
+        if (functionTableBlob)
+            sparseFunctionTable = true;
+
+        auto unreachable = main["unreachable_functions"].value_or<std::string>("keep");
+        if (unreachable == "cold")
+            unreachableFunctions = RecompilerUnreachableFunctions::Cold;
+        else if (unreachable == "skip")
+            unreachableFunctions = RecompilerUnreachableFunctions::Skip;
+        else if (unreachable != "keep")
+            fmt::println("ERROR: Unknown unreachable function mode: {}", unreachable);
 
         restGpr14Address = main["restgprlr_14_address"].value_or(0u);
         saveGpr14Address = main["savegprlr_14_address"].value_or(0u);
@@ -69,6 +97,43 @@ void RecompilerConfig::Load(const std::string_view& configFilePath)
             }
         }
 
+        if (auto reachableArray = main["reachable_functions"].as_array())
+        {
+            for (auto& address : *reachableArray)
+            {
+                if (auto value = address.value<uint32_t>())
+                    reachableFunctions.push_back(*value);
+                else
+                    fmt::println("ERROR: Invalid reachable function address");
+            }
+        }
+
+        if (auto noInlineArray = main["no_inline_functions"].as_array())
+        {
+            for (auto& address : *noInlineArray)
+            {
+                if (auto value = address.value<uint32_t>())
+                    noInlineFunctions.emplace(*value);
+                else
+                    fmt::println("ERROR: Invalid no-inline function address");
+            }
+        }
+
+        if (auto isaLevelArray = main["isa_levels"].as_array())
+        {
+            for (auto& level : *isaLevelArray)
+            {
+                auto name = level.value_or<std::string>("");
+                if (name == "sse" || name == "avx2" || name == "avx512")
+                    isaLevels.push_back(name);
+                else
+                    fmt::println("ERROR: Unknown ISA level: {}", name);
+            }
+
+            if (!isaLevels.empty() && std::find(isaLevels.begin(), isaLevels.end(), "sse") == isaLevels.end())
+                fmt::println("ERROR: ISA levels must include \"sse\" to fall back to");
+        }
+
         if (!switchTableFilePath.empty())
         {
             toml::table switchToml = toml::parse_file(directoryPath + switchTableFilePath)
@@ -91,6 +156,40 @@ void RecompilerConfig::Load(const std::string_view& configFilePath)
                 }
             }
         }
+
+        if (!indirectCallFilePath.empty())
+        {
+            toml::table indirectCallToml = toml::parse_file(directoryPath + indirectCallFilePath)
+#if !TOML_EXCEPTIONS
+                .table()
+#endif
+                ;
+            if (auto indirectCallArray = indirectCallToml["indirect_call"].as_array())
+            {
+                for (auto& entry : *indirectCallArray)
+                {
+                    auto table = entry.as_table();
+                    auto address = table != nullptr ? (*table)["address"].value<uint32_t>() : std::nullopt;
+                    auto targetArray = table != nullptr ? (*table)["targets"].as_array() : nullptr;
+                    if (!address || targetArray == nullptr)
+                    {
+                        fmt::println("ERROR: Invalid indirect call entry");
+                        continue;
+                    }
+
+                    RecompilerIndirectCall indirectCall;
+                    for (auto& target : *targetArray)
+                    {
+                        if (auto targetAddress = target.value<uint32_t>())
+                            indirectCall.targets.push_back(*targetAddress);
+                        else
+                            fmt::println("ERROR: Invalid indirect call target at {:X}", *address);
+                    }
+                    indirectCall.direct = (*table)["direct"].value_or(false);
+                    indirectCalls.emplace(*address, std::move(indirectCall));
+                }
+            }
+        }
     }
 
     if (auto midAsmHookArray = toml["midasm_hook"].as_array())
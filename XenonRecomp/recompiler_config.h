@@ -6,6 +6,19 @@ struct RecompilerSwitchTable
     std::vector<uint32_t> labels;
 };
 
+struct RecompilerIndirectCall
+{
+    std::vector<uint32_t> targets;
+    bool direct = false;
+};
+
+enum class RecompilerUnreachableFunctions
+{
+    Keep,
+    Cold,
+    Skip
+};
+
 struct RecompilerMidAsmHook
 {
     std::string name;
@@ -28,9 +41,17 @@ struct RecompilerConfig
     std::string filePath;
     std::string patchFilePath;
     std::string patchedFilePath;
+    std::string imageCacheFilePath;
     std::string outDirectoryPath;
     std::string switchTableFilePath;
+    std::string profileFilePath;
+    std::string profileMapFilePath;
+    std::string statsFilePath;
+    std::string functionReportFilePath;
     std::unordered_map<uint32_t, RecompilerSwitchTable> switchTables;
+    std::string indirectCallFilePath;
+    std::unordered_map<uint32_t, RecompilerIndirectCall> indirectCalls;
+    bool skipHashVerification = false;
     bool skipLr = false;
     bool ctrAsLocalVariable = false;
     bool xerAsLocalVariable = false;
@@ -39,6 +60,17 @@ struct RecompilerConfig
     bool crRegistersAsLocalVariables = false;
     bool nonArgumentRegistersAsLocalVariables = false;
     bool nonVolatileRegistersAsLocalVariables = false;
+    bool packedCrRegisters = false;
+    bool narrowIntegerOperations = false;
+    bool profileInstrumentation = false;
+    bool profileBlocks = false;
+    bool guestPcMarkers = false;
+    RecompilerUnreachableFunctions unreachableFunctions = RecompilerUnreachableFunctions::Keep;
+    bool deduplicateFunctions = false;
+    uint32_t inlineInstructionBudget = 0;
+    std::vector<std::string> isaLevels;
+    bool sparseFunctionTable = false;
+    bool functionTableBlob = false;
     uint32_t restGpr14Address = 0;
     uint32_t saveGpr14Address = 0;
     uint32_t restFpr14Address = 0;
@@ -51,6 +83,8 @@ struct RecompilerConfig
     uint32_t setJmpAddress = 0;
     std::unordered_map<uint32_t, uint32_t> functions;
     std::unordered_map<uint32_t, uint32_t> invalidInstructions;
+    std::vector<uint32_t> reachableFunctions;
+    std::unordered_set<uint32_t> noInlineFunctions;
     std::unordered_map<uint32_t, RecompilerMidAsmHook> midAsmHooks;
 
     void Load(const std::string_view& configFilePath);
@@ -0,0 +1,204 @@
+#include "pch.h"
+#include "recompiler_stats.h"
+
+#if defined(_WIN32)
+#   define NOMINMAX
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <ctime>
+#   include <sys/resource.h>
+#endif
+
+RecompilerTimer::RecompilerTimer()
+    : wallStart(std::chrono::steady_clock::now()), cpuStart(RecompilerStats::GetProcessCpuTime())
+{
+}
+
+double RecompilerTimer::GetWallTime() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+}
+
+double RecompilerTimer::GetCpuTime() const
+{
+    return RecompilerStats::GetProcessCpuTime() - cpuStart;
+}
+
+RecompilerStats::Scope::Scope(RecompilerStats& stats, std::string_view name)
+    : stats(stats), index(stats.GetPhaseIndex(name))
+{
+}
+
+RecompilerStats::Scope::~Scope()
+{
+    auto& phase = stats.phases[index];
+    ++phase.calls;
+    phase.wallTime += timer.GetWallTime();
+    phase.cpuTime += timer.GetCpuTime();
+    phase.peakMemory = GetPeakMemory();
+    phase.items += items;
+    phase.bytes += bytes;
+}
+
+size_t RecompilerStats::GetPhaseIndex(std::string_view name)
+{
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        if (phases[i].name == name)
+            return i;
+    }
+
+    phases.emplace_back().name = name;
+    return phases.size() - 1;
+}
+
+void RecompilerStats::AddShard(std::string name, const RecompilerTimer& timer, size_t functions, size_t bytes)
+{
+    auto& shard = shards.emplace_back();
+    shard.name = std::move(name);
+    shard.wallTime = timer.GetWallTime();
+    shard.cpuTime = timer.GetCpuTime();
+    shard.functions = functions;
+    shard.bytes = bytes;
+
+    // The shards are also summed up like any other phase.
+    auto& phase = phases[GetPhaseIndex("RecompileShard")];
+    ++phase.calls;
+    phase.wallTime += shard.wallTime;
+    phase.cpuTime += shard.cpuTime;
+    phase.peakMemory = GetPeakMemory();
+    phase.items += functions;
+    phase.bytes += bytes;
+}
+
+void RecompilerStats::Print() const
+{
+    fmt::println("{:<20} {:>8} {:>10} {:>10} {:>10} {:>10} {:>12} {:>10}", "Phase", "Calls", "Wall (s)", "CPU (s)", "Peak (MiB)", "Items", "Items/s", "MiB/s");
+
+    for (auto& phase : phases)
+    {
+        double itemsPerSecond = phase.wallTime > 0.0 ? phase.items / phase.wallTime : 0.0;
+        double bytesPerSecond = phase.wallTime > 0.0 ? phase.bytes / phase.wallTime : 0.0;
+
+        fmt::println("{:<20} {:>8} {:>10.3f} {:>10.3f} {:>10.1f} {:>10} {:>12.0f} {:>10.1f}", phase.name, phase.calls, phase.wallTime, phase.cpuTime,
+            phase.peakMemory / (1024.0 * 1024.0), phase.items, itemsPerSecond, bytesPerSecond / (1024.0 * 1024.0));
+    }
+
+    if (!shards.empty())
+    {
+        auto slowest = std::max_element(shards.begin(), shards.end(), [](auto& lhs, auto& rhs) { return lhs.wallTime < rhs.wallTime; });
+        fmt::println("Slowest shard: {} with {} functions in {:.3f} s", slowest->name, slowest->functions, slowest->wallTime);
+    }
+}
+
+bool RecompilerStats::Save(const std::filesystem::path& path) const
+{
+    FILE* f = fopen(path.string().c_str(), "w");
+    if (f == nullptr)
+        return false;
+
+    // The names are generated by the recompiler and never need escaping.
+    fmt::println(f, "{{");
+    fmt::println(f, "  \"phases\": [");
+
+    for (size_t i = 0; i < phases.size(); i++)
+    {
+        auto& phase = phases[i];
+        fmt::println(f, "    {{ \"name\": \"{}\", \"calls\": {}, \"wall_time\": {:.6f}, \"cpu_time\": {:.6f}, \"peak_memory\": {}, \"items\": {}, \"bytes\": {} }}{}",
+            phase.name, phase.calls, phase.wallTime, phase.cpuTime, phase.peakMemory, phase.items, phase.bytes, i + 1 < phases.size() ? "," : "");
+    }
+
+    fmt::println(f, "  ],");
+    fmt::println(f, "  \"shards\": [");
+
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        auto& shard = shards[i];
+        fmt::println(f, "    {{ \"name\": \"{}\", \"wall_time\": {:.6f}, \"cpu_time\": {:.6f}, \"functions\": {}, \"bytes\": {} }}{}",
+            shard.name, shard.wallTime, shard.cpuTime, shard.functions, shard.bytes, i + 1 < shards.size() ? "," : "");
+    }
+
+    fmt::println(f, "  ]");
+    fmt::println(f, "}}");
+
+    return fclose(f) == 0;
+}
+
+bool RecompilerStats::SaveFunctions(const std::filesystem::path& path) const
+{
+    FILE* f = fopen(path.string().c_str(), "w");
+    if (f == nullptr)
+        return false;
+
+    if (path.extension() == ".json")
+    {
+        fmt::println(f, "[");
+
+        for (size_t i = 0; i < functions.size(); i++)
+        {
+            auto& function = functions[i];
+            fmt::println(f, "  {{ \"name\": \"{}\", \"address\": {}, \"size\": {}, \"blocks\": {}, \"output_bytes\": {}, \"context_accesses\": {}, \"local_accesses\": {}, "
+                "\"calls\": {}, \"indirect_calls\": {}, \"switch_tables\": {}, \"unrecognized_instructions\": {}, \"csr_mode_switches\": {} }}{}",
+                function.name, function.address, function.size, function.blockCount, function.outputBytes, function.contextAccessCount, function.localAccessCount,
+                function.callCount, function.indirectCallCount, function.switchTableCount, function.unrecognizedInstructionCount, function.csrModeSwitchCount,
+                i + 1 < functions.size() ? "," : "");
+        }
+
+        fmt::println(f, "]");
+    }
+    else
+    {
+        fmt::println(f, "name,address,size,blocks,output_bytes,context_accesses,local_accesses,calls,indirect_calls,switch_tables,unrecognized_instructions,csr_mode_switches");
+
+        for (auto& function : functions)
+        {
+            fmt::println(f, "{},0x{:X},{},{},{},{},{},{},{},{},{},{}", function.name, function.address, function.size, function.blockCount, function.outputBytes,
+                function.contextAccessCount, function.localAccessCount, function.callCount, function.indirectCallCount, function.switchTableCount,
+                function.unrecognizedInstructionCount, function.csrModeSwitchCount);
+        }
+    }
+
+    return fclose(f) == 0;
+}
+
+double RecompilerStats::GetProcessCpuTime()
+{
+#if defined(_WIN32)
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+        return 0.0;
+
+    // Both times are in 100 nanosecond units.
+    auto toSeconds = [](const FILETIME& time) { return ((uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7; };
+    return toSeconds(kernelTime) + toSeconds(userTime);
+#else
+    timespec time;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+        return 0.0;
+
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+size_t RecompilerStats::GetPeakMemory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    // Reported in bytes on macOS and in kilobytes everywhere else.
+#if defined(__APPLE__)
+    return size_t(usage.ru_maxrss);
+#else
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+
+// Totals of every call to a phase. The CPU time is the one of the whole process, so it includes the other threads
+// running in the meantime, like the output writer. The peak memory is the peak resident set size at the end of the phase.
+struct RecompilerPhaseStats
+{
+    std::string name;
+    size_t calls{};
+    double wallTime{};
+    double cpuTime{};
+    size_t peakMemory{};
+    size_t items{};
+    size_t bytes{};
+};
+
+struct RecompilerShardStats
+{
+    std::string name;
+    double wallTime{};
+    double cpuTime{};
+    size_t functions{};
+    size_t bytes{};
+};
+
+// Counts of what was emitted for a function, where register accesses either go through the context or local variables.
+struct RecompilerFunctionStats
+{
+    std::string name;
+    size_t address{};
+    size_t size{};
+    size_t blockCount{};
+    size_t outputBytes{};
+    size_t contextAccessCount{};
+    size_t localAccessCount{};
+    size_t callCount{};
+    size_t indirectCallCount{};
+    size_t switchTableCount{};
+    size_t unrecognizedInstructionCount{};
+    size_t csrModeSwitchCount{};
+};
+
+struct RecompilerTimer
+{
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart{};
+
+    RecompilerTimer();
+    double GetWallTime() const;
+    double GetCpuTime() const;
+};
+
+struct RecompilerStats
+{
+    // Measures a phase until it goes out of scope, adding the items and bytes it processed to it.
+    struct Scope
+    {
+        RecompilerStats& stats;
+        size_t index;
+        RecompilerTimer timer;
+        size_t items{};
+        size_t bytes{};
+
+        Scope(RecompilerStats& stats, std::string_view name);
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope();
+    };
+
+    // Phases are kept in the order they were first entered.
+    std::vector<RecompilerPhaseStats> phases;
+    std::vector<RecompilerShardStats> shards;
+    std::vector<RecompilerFunctionStats> functions;
+
+    size_t GetPhaseIndex(std::string_view name);
+    void AddShard(std::string name, const RecompilerTimer& timer, size_t functions, size_t bytes);
+
+    void Print() const;
+    bool Save(const std::filesystem::path& path) const;
+
+    // Writes the function stats as JSON when the extension is .json, and as CSV otherwise.
+    bool SaveFunctions(const std::filesystem::path& path) const;
+
+    static double GetProcessCpuTime();
+    static size_t GetPeakMemory();
+};
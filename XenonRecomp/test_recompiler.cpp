@@ -32,7 +32,7 @@ void TestRecompiler::Analyse(const std::string_view& testName)
     std::sort(functions.begin(), functions.end(), [](auto& lhs, auto& rhs) { return lhs.base < rhs.base; });
 }
 
-void TestRecompiler::RecompileTests(const char* srcDirectoryPath, const char* dstDirectoryPath)
+void TestRecompiler::RecompileTests(const char* srcDirectoryPath, const char* dstDirectoryPath, bool packedCrRegisters, bool narrowIntegerOperations)
 {
     std::map<std::string, std::unordered_set<size_t>> functions;
 
@@ -40,16 +40,21 @@ void TestRecompiler::RecompileTests(const char* srcDirectoryPath, const char* ds
     {
         if (file.path().extension() == ".o")
         {
-            const auto exeFile = LoadFile(file.path().string().c_str());
-
             TestRecompiler recompiler;
             recompiler.config.outDirectoryPath = dstDirectoryPath;
-            recompiler.image = Image::ParseImage(exeFile.data(), exeFile.size());
+            recompiler.config.packedCrRegisters = packedCrRegisters;
+            recompiler.config.narrowIntegerOperations = narrowIntegerOperations;
+            recompiler.image = Image::ParseImage(file.path());
+
+            // The tests check every register after returning, not only the ones the ABI keeps.
+            recompiler.returnRegisters = ~0u;
 
             auto stem = file.path().stem().string();
             recompiler.Analyse(stem);
 
             recompiler.println("#define PPC_CONFIG_H_INCLUDED");
+            if (packedCrRegisters)
+                recompiler.println("#define PPC_CONFIG_PACKED_CR");
             recompiler.println("#include <ppc_context.h>\n");
             recompiler.println("#define __builtin_debugtrap()\n");
 
@@ -101,6 +106,8 @@ void TestRecompiler::RecompileTests(const char* srcDirectoryPath, const char* ds
     std::string main;
 
     fmt::println(file, "#define PPC_CONFIG_H_INCLUDED");
+    if (packedCrRegisters)
+        fmt::println(file, "#define PPC_CONFIG_PACKED_CR");
     fmt::println(file, "#include <ppc_context.h>");
     fmt::println(file, "#ifdef _WIN32");
     fmt::println(file, "#include <Windows.h>");
@@ -6,5 +6,5 @@ struct TestRecompiler : Recompiler
     void Analyse(const std::string_view& testName);
     void Reset();
     
-    static void RecompileTests(const char* srcDirectoryPath, const char* dstDirectoryPath);
+    static void RecompileTests(const char* srcDirectoryPath, const char* dstDirectoryPath, bool packedCrRegisters = false, bool narrowIntegerOperations = false);
 };
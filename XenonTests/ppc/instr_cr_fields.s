@@ -0,0 +1,173 @@
+# Every CR field set by mtcrf/mtocrf and read by mfcr/mfocrf, one field at a time and all at once.
+
+test_cr_fields_mfcr:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000013579BDF
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_0:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x80
+  blr
+  #_ REGISTER_OUT r3 0x0000000010000000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_1:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x40
+  blr
+  #_ REGISTER_OUT r3 0x0000000003000000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_2:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x20
+  blr
+  #_ REGISTER_OUT r3 0x0000000000500000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_3:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x10
+  blr
+  #_ REGISTER_OUT r3 0x0000000000070000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_4:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x8
+  blr
+  #_ REGISTER_OUT r3 0x0000000000009000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_5:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x4
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000B00
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_6:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x2
+  blr
+  #_ REGISTER_OUT r3 0x00000000000000D0
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mfocrf_7:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  mtcrf 0xFF, r4
+  mfocrf r3, 0x1
+  blr
+  #_ REGISTER_OUT r3 0x000000000000000F
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+
+test_cr_fields_mtocrf_0:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x80, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000010000000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_1:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x40, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000003000000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_2:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x20, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000000500000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_3:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x10, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000000070000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_4:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x8, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000000009000
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_5:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x4, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000B00
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_6:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x2, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x00000000000000D0
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtocrf_7:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtocrf 0x1, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x000000000000000F
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_cr_fields_mtcrf_multiple:
+  #_ REGISTER_IN r4 0x0000000013579BDF
+  #_ REGISTER_IN r5 0x0000000000000000
+  mtcrf 0xFF, r5
+  mtcrf 0x81, r4
+  mfcr r3
+  blr
+  #_ REGISTER_OUT r3 0x000000001000000F
+  #_ REGISTER_OUT r4 0x0000000013579BDF
+  #_ REGISTER_OUT r5 0x0000000000000000
+
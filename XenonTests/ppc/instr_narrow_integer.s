@@ -0,0 +1,104 @@
+# Results of the operations narrowed by narrow_integer_operations, with their upper half observed by the next
+# instruction, across a call or after returning. The destination is cleared after being read, so only the reading
+# instruction keeps the upper half observed.
+
+test_narrow_add_srdi:
+  #_ REGISTER_IN r3 0x00000001FFFFFFFF
+  #_ REGISTER_IN r4 0x0000000000000001
+  add r5, r3, r4
+  srdi r3, r5, 32
+  li r5, 0
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000002
+  #_ REGISTER_OUT r4 0x0000000000000001
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_narrow_addi_rldicl:
+  #_ REGISTER_IN r3 0x00000000FFFFFFFF
+  addi r5, r3, 1
+  rldicl r3, r5, 32, 48
+  li r5, 0
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000001
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_narrow_add_cmpd:
+  #_ REGISTER_IN r3 0x00000000FFFFFFFF
+  #_ REGISTER_IN r4 0x0000000000000001
+  #_ REGISTER_IN r6 0x0000000000000000
+  add r5, r3, r4
+  cmpd r5, r6
+  mfcr r3
+  li r5, 0
+  blr
+  #_ REGISTER_OUT r3 0x0000000040000000
+  #_ REGISTER_OUT r4 0x0000000000000001
+  #_ REGISTER_OUT r5 0x0000000000000000
+  #_ REGISTER_OUT r6 0x0000000000000000
+
+test_narrow_addi_std:
+  #_ REGISTER_IN r3 0x00000000FFFFFFFF
+  #_ REGISTER_IN r6 0x0000000000010000
+  addi r5, r3, 1
+  std r5, 0(r6)
+  ld r3, 0(r6)
+  li r5, 0
+  blr
+  #_ REGISTER_OUT r3 0x0000000100000000
+  #_ REGISTER_OUT r5 0x0000000000000000
+  #_ REGISTER_OUT r6 0x0000000000010000
+
+test_narrow_mullw_srdi:
+  #_ REGISTER_IN r3 0x0000000000010000
+  #_ REGISTER_IN r4 0x0000000000010000
+  mullw r5, r3, r4
+  srdi r3, r5, 32
+  li r5, 0
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000001
+  #_ REGISTER_OUT r4 0x0000000000010000
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+# Only the lower half is read here, so the add is narrowed.
+test_narrow_add_extsw:
+  #_ REGISTER_IN r3 0x000000017FFFFFFF
+  #_ REGISTER_IN r4 0x0000000000000001
+  add r5, r3, r4
+  extsw r3, r5
+  li r5, 0
+  blr
+  #_ REGISTER_OUT r3 0xFFFFFFFF80000000
+  #_ REGISTER_OUT r4 0x0000000000000001
+  #_ REGISTER_OUT r5 0x0000000000000000
+
+test_narrow_call_add:
+  #_ REGISTER_IN r3 0x00000001FFFFFFFF
+  #_ REGISTER_IN r4 0x0000000000000001
+  mflr r12
+  add r3, r3, r4
+  bl test_narrow_call_srdi
+  mtlr r12
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000002
+  #_ REGISTER_OUT r4 0x0000000000000001
+
+test_narrow_call_srdi:
+  #_ REGISTER_IN r3 0x0000000200000000
+  srdi r3, r3, 32
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000002
+
+test_narrow_return_srdi:
+  #_ REGISTER_IN r3 0x00000000FFFFFFFF
+  mflr r12
+  bl test_narrow_return_addi
+  srdi r3, r3, 32
+  mtlr r12
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000001
+
+test_narrow_return_addi:
+  #_ REGISTER_IN r3 0x00000000FFFFFFFF
+  addi r3, r3, 1
+  blr
+  #_ REGISTER_OUT r3 0x0000000100000000
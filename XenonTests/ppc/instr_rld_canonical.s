@@ -0,0 +1,110 @@
+# Canonical forms of rldicl, rldicr, rldic and rldimi, including rldic and rldimi masks wrapping around.
+
+test_rld_canonical_0:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicl r3, r4, 0, 0
+  blr
+  #_ REGISTER_OUT r3 0x0123456789ABCDEF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_1:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicl r3, r4, 0, 16
+  blr
+  #_ REGISTER_OUT r3 0x0000456789ABCDEF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_2:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicl r3, r4, 8, 0
+  blr
+  #_ REGISTER_OUT r3 0x23456789ABCDEF01
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_3:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicl r3, r4, 56, 8
+  blr
+  #_ REGISTER_OUT r3 0x000123456789ABCD
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_4:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicl r3, r4, 20, 40
+  blr
+  #_ REGISTER_OUT r3 0x0000000000F01234
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_5:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicr r3, r4, 0, 47
+  blr
+  #_ REGISTER_OUT r3 0x0123456789AB0000
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_6:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicr r3, r4, 8, 55
+  blr
+  #_ REGISTER_OUT r3 0x23456789ABCDEF00
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_7:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicr r3, r4, 24, 31
+  blr
+  #_ REGISTER_OUT r3 0x6789ABCD00000000
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_8:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldicr r3, r4, 4, 63
+  blr
+  #_ REGISTER_OUT r3 0x123456789ABCDEF0
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_9:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldic r3, r4, 0, 8
+  blr
+  #_ REGISTER_OUT r3 0x0023456789ABCDEF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_10:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldic r3, r4, 8, 16
+  blr
+  #_ REGISTER_OUT r3 0x00006789ABCDEF00
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_11:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldic r3, r4, 60, 8
+  blr
+  #_ REGISTER_OUT r3 0xF0123456789ABCDE
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_12:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldimi r3, r4, 0, 16
+  blr
+  #_ REGISTER_OUT r3 0xFEDC456789ABCDEF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_13:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldimi r3, r4, 16, 32
+  blr
+  #_ REGISTER_OUT r3 0xFEDCBA98CDEF3210
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rld_canonical_14:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rldimi r3, r4, 60, 8
+  blr
+  #_ REGISTER_OUT r3 0xFE123456789ABCDE
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
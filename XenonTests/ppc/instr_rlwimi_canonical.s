@@ -0,0 +1,50 @@
+# Canonical forms of rlwimi, including masks wrapping around (MB > ME), which also insert into the upper half.
+
+test_rlwimi_canonical_0:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwimi r3, r4, 0, 0, 31
+  blr
+  #_ REGISTER_OUT r3 0xFEDCBA9889ABCDEF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwimi_canonical_1:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwimi r3, r4, 0, 8, 23
+  blr
+  #_ REGISTER_OUT r3 0xFEDCBA9876ABCD10
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwimi_canonical_2:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwimi r3, r4, 8, 16, 23
+  blr
+  #_ REGISTER_OUT r3 0xFEDCBA987654EF10
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwimi_canonical_3:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwimi r3, r4, 16, 0, 15
+  blr
+  #_ REGISTER_OUT r3 0xFEDCBA98CDEF3210
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwimi_canonical_4:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwimi r3, r4, 4, 28, 3
+  blr
+  #_ REGISTER_OUT r3 0x9ABCDEF896543218
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwimi_canonical_5:
+  #_ REGISTER_IN r3 0xFEDCBA9876543210
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwimi r3, r4, 0, 24, 7
+  blr
+  #_ REGISTER_OUT r3 0x89ABCDEF895432EF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
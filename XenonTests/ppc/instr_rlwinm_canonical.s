@@ -0,0 +1,72 @@
+# Canonical forms of rlwinm: plain masks, shifts, extracts, rotates and masks wrapping around (MB > ME).
+
+test_rlwinm_canonical_0:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 0, 0, 31
+  blr
+  #_ REGISTER_OUT r3 0x0000000089ABCDEF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_1:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 0, 8, 23
+  blr
+  #_ REGISTER_OUT r3 0x0000000000ABCD00
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_2:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 0, 24, 7
+  blr
+  #_ REGISTER_OUT r3 0x89ABCDEF890000EF
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_3:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 4, 0, 27
+  blr
+  #_ REGISTER_OUT r3 0x000000009ABCDEF0
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_4:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 28, 4, 31
+  blr
+  #_ REGISTER_OUT r3 0x00000000089ABCDE
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_5:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 12, 20, 27
+  blr
+  #_ REGISTER_OUT r3 0x0000000000000890
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_6:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 16, 0, 31
+  blr
+  #_ REGISTER_OUT r3 0x00000000CDEF89AB
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_7:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 4, 28, 3
+  blr
+  #_ REGISTER_OUT r3 0x9ABCDEF890000008
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_8:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 8, 24, 15
+  blr
+  #_ REGISTER_OUT r3 0xABCDEF89ABCD0089
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
+test_rlwinm_canonical_9:
+  #_ REGISTER_IN r4 0x0123456789ABCDEF
+  rlwinm r3, r4, 31, 31, 0
+  blr
+  #_ REGISTER_OUT r3 0xC4D5E6F780000001
+  #_ REGISTER_OUT r4 0x0123456789ABCDEF
+
@@ -0,0 +1,244 @@
+#include "aes_cbc.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <aes.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#   define AES_CBC_X86
+#   include <immintrin.h>
+#endif
+
+static constexpr size_t c_blockSize = 16;
+
+// Blocks decrypted together to hide the latency of the AES instructions.
+static constexpr size_t c_blocksInFlight = 8;
+
+// Threads are only worth starting for at least this many bytes each.
+static constexpr size_t c_minThreadSize = 1024 * 1024;
+
+static void DecryptFallback(const uint8_t* key, const uint8_t* iv, const uint8_t* src, uint8_t* dst, size_t size)
+{
+    if (dst != src)
+        memcpy(dst, src, size);
+
+    AES_ctx aesContext;
+    AES_init_ctx_iv(&aesContext, key, iv);
+    AES_CBC_decrypt_buffer(&aesContext, dst, size);
+}
+
+#ifdef AES_CBC_X86
+
+#define AES_EXPAND_KEY(INDEX, RCON) \
+    roundKeys[INDEX] = ExpandKeyStep(roundKeys[INDEX - 1], _mm_aeskeygenassist_si128(roundKeys[INDEX - 1], RCON))
+
+__attribute__((target("aes")))
+static __m128i ExpandKeyStep(__m128i key, __m128i assist)
+{
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, _mm_shuffle_epi32(assist, 0xFF));
+}
+
+// Expands the key into the round keys of the equivalent inverse cipher used by AESDEC.
+__attribute__((target("aes")))
+static void ExpandDecryptionKeys(const uint8_t* key, __m128i* decryptionKeys)
+{
+    __m128i roundKeys[11];
+    roundKeys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    AES_EXPAND_KEY(1, 0x01);
+    AES_EXPAND_KEY(2, 0x02);
+    AES_EXPAND_KEY(3, 0x04);
+    AES_EXPAND_KEY(4, 0x08);
+    AES_EXPAND_KEY(5, 0x10);
+    AES_EXPAND_KEY(6, 0x20);
+    AES_EXPAND_KEY(7, 0x40);
+    AES_EXPAND_KEY(8, 0x80);
+    AES_EXPAND_KEY(9, 0x1B);
+    AES_EXPAND_KEY(10, 0x36);
+
+    decryptionKeys[0] = roundKeys[10];
+    for (size_t i = 1; i < 10; i++)
+        decryptionKeys[i] = _mm_aesimc_si128(roundKeys[10 - i]);
+
+    decryptionKeys[10] = roundKeys[0];
+}
+
+#undef AES_EXPAND_KEY
+
+__attribute__((target("aes")))
+static __m128i DecryptBlock(__m128i block, const __m128i* decryptionKeys)
+{
+    block = _mm_xor_si128(block, decryptionKeys[0]);
+    for (size_t i = 1; i < 10; i++)
+        block = _mm_aesdec_si128(block, decryptionKeys[i]);
+
+    return _mm_aesdeclast_si128(block, decryptionKeys[10]);
+}
+
+// Decrypts the blocks that don't fill a whole group and returns the last ciphertext block.
+__attribute__((target("aes")))
+static __m128i DecryptTail(const uint8_t* src, uint8_t* dst, size_t blockCount, __m128i previous, const __m128i* decryptionKeys)
+{
+    for (size_t i = 0; i < blockCount; i++)
+    {
+        __m128i ciphertext = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * c_blockSize));
+        __m128i block = DecryptBlock(ciphertext, decryptionKeys);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * c_blockSize), _mm_xor_si128(block, previous));
+        previous = ciphertext;
+    }
+
+    return previous;
+}
+
+// All the ciphertext blocks of a group are loaded before any plaintext is stored, so the decryption can be done in place.
+__attribute__((target("aes")))
+static void DecryptAesNi(const uint8_t* key, const uint8_t* iv, const uint8_t* src, uint8_t* dst, size_t blockCount)
+{
+    __m128i decryptionKeys[11];
+    ExpandDecryptionKeys(key, decryptionKeys);
+
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+
+    for (; blockCount >= c_blocksInFlight; blockCount -= c_blocksInFlight)
+    {
+        __m128i ciphertexts[c_blocksInFlight];
+        __m128i blocks[c_blocksInFlight];
+
+        for (size_t i = 0; i < c_blocksInFlight; i++)
+        {
+            ciphertexts[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * c_blockSize));
+            blocks[i] = _mm_xor_si128(ciphertexts[i], decryptionKeys[0]);
+        }
+
+        for (size_t round = 1; round < 10; round++)
+        {
+            for (size_t i = 0; i < c_blocksInFlight; i++)
+                blocks[i] = _mm_aesdec_si128(blocks[i], decryptionKeys[round]);
+        }
+
+        for (size_t i = 0; i < c_blocksInFlight; i++)
+        {
+            blocks[i] = _mm_aesdeclast_si128(blocks[i], decryptionKeys[10]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * c_blockSize), _mm_xor_si128(blocks[i], i == 0 ? previous : ciphertexts[i - 1]));
+        }
+
+        previous = ciphertexts[c_blocksInFlight - 1];
+        src += c_blocksInFlight * c_blockSize;
+        dst += c_blocksInFlight * c_blockSize;
+    }
+
+    DecryptTail(src, dst, blockCount, previous, decryptionKeys);
+}
+
+// Same as above with two blocks in every register.
+__attribute__((target("aes,avx2,vaes")))
+static void DecryptVaes(const uint8_t* key, const uint8_t* iv, const uint8_t* src, uint8_t* dst, size_t blockCount)
+{
+    constexpr size_t c_registersInFlight = c_blocksInFlight / 2;
+
+    __m128i decryptionKeys[11];
+    ExpandDecryptionKeys(key, decryptionKeys);
+
+    __m256i wideDecryptionKeys[11];
+    for (size_t i = 0; i < 11; i++)
+        wideDecryptionKeys[i] = _mm256_broadcastsi128_si256(decryptionKeys[i]);
+
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+
+    for (; blockCount >= c_blocksInFlight; blockCount -= c_blocksInFlight)
+    {
+        __m256i ciphertexts[c_registersInFlight];
+        __m256i previousCiphertexts[c_registersInFlight];
+        __m256i blocks[c_registersInFlight];
+
+        for (size_t i = 0; i < c_registersInFlight; i++)
+        {
+            ciphertexts[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2 * c_blockSize));
+            blocks[i] = _mm256_xor_si256(ciphertexts[i], wideDecryptionKeys[0]);
+        }
+
+        // The source of the group is not overwritten yet, so the previous blocks can be loaded from it, apart from the first.
+        previousCiphertexts[0] = _mm256_inserti128_si256(_mm256_castsi128_si256(previous), _mm256_castsi256_si128(ciphertexts[0]), 1);
+        for (size_t i = 1; i < c_registersInFlight; i++)
+            previousCiphertexts[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + (i * 2 - 1) * c_blockSize));
+
+        for (size_t round = 1; round < 10; round++)
+        {
+            for (size_t i = 0; i < c_registersInFlight; i++)
+                blocks[i] = _mm256_aesdec_epi128(blocks[i], wideDecryptionKeys[round]);
+        }
+
+        for (size_t i = 0; i < c_registersInFlight; i++)
+        {
+            blocks[i] = _mm256_aesdeclast_epi128(blocks[i], wideDecryptionKeys[10]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2 * c_blockSize), _mm256_xor_si256(blocks[i], previousCiphertexts[i]));
+        }
+
+        previous = _mm256_extracti128_si256(ciphertexts[c_registersInFlight - 1], 1);
+        src += c_blocksInFlight * c_blockSize;
+        dst += c_blocksInFlight * c_blockSize;
+    }
+
+    DecryptTail(src, dst, blockCount, previous, decryptionKeys);
+}
+
+#endif
+
+static void DecryptBlocks(const uint8_t* key, const uint8_t* iv, const uint8_t* src, uint8_t* dst, size_t blockCount)
+{
+#ifdef AES_CBC_X86
+    static const bool s_hasVaes = __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("aes");
+    static const bool s_hasAesNi = __builtin_cpu_supports("aes");
+
+    if (s_hasVaes)
+        DecryptVaes(key, iv, src, dst, blockCount);
+    else if (s_hasAesNi)
+        DecryptAesNi(key, iv, src, dst, blockCount);
+    else
+#endif
+        DecryptFallback(key, iv, src, dst, blockCount * c_blockSize);
+}
+
+void AesCbcDecrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* src, uint8_t* dst, size_t size, size_t threadCount)
+{
+    size_t blockCount = size / c_blockSize;
+    size_t remainder = size % c_blockSize;
+
+    if (remainder != 0 && dst != src)
+        memcpy(dst + blockCount * c_blockSize, src + blockCount * c_blockSize, remainder);
+
+    threadCount = std::min(threadCount, size / c_minThreadSize);
+    if (threadCount <= 1)
+    {
+        DecryptBlocks(key, iv, src, dst, blockCount);
+        return;
+    }
+
+    // Every chunk uses the last ciphertext block of the previous chunk as its IV. These need to be
+    // copied before starting, as the previous chunk might overwrite them when decrypting in place.
+    size_t chunkBlockCount = (blockCount + threadCount - 1) / threadCount;
+    std::vector<uint8_t> chunkIvs(threadCount * c_blockSize);
+    memcpy(chunkIvs.data(), iv, c_blockSize);
+
+    for (size_t i = 1; i < threadCount; i++)
+        memcpy(&chunkIvs[i * c_blockSize], src + (i * chunkBlockCount - 1) * c_blockSize, c_blockSize);
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+
+    for (size_t i = 1; i < threadCount; i++)
+    {
+        size_t offset = i * chunkBlockCount * c_blockSize;
+        size_t count = std::min(chunkBlockCount, blockCount - i * chunkBlockCount);
+        threads.emplace_back(DecryptBlocks, key, &chunkIvs[i * c_blockSize], src + offset, dst + offset, count);
+    }
+
+    DecryptBlocks(key, chunkIvs.data(), src, dst, chunkBlockCount);
+
+    for (auto& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Decrypts the data with AES-128 in CBC mode, like tiny-AES's AES_CBC_decrypt_buffer. The source and the destination
+// can be the same buffer. Bytes after the last full block are copied as is. Uses AES-NI, or VAES when available, with
+// several blocks in flight, and falls back to tiny-AES otherwise. CBC decryption of a block only depends on the
+// ciphertext, so large buffers are additionally split across up to the specified number of threads.
+void AesCbcDecrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* src, uint8_t* dst, size_t size, size_t threadCount = 1);
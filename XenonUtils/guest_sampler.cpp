@@ -0,0 +1,168 @@
+#include "guest_sampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#   include <csignal>
+#   include <sys/time.h>
+#endif
+
+struct GuestSamplerEntry
+{
+    std::atomic<uint32_t> address;
+    std::atomic<uint64_t> count;
+};
+
+// Samples are recorded from a signal handler, so they are stored in a fixed size
+// open addressing table that does not need any allocations or locks.
+static constexpr size_t c_sampleTableBits = 16;
+static constexpr size_t c_sampleTableSize = 1ull << c_sampleTableBits;
+
+static GuestSamplerEntry gSampleTable[c_sampleTableSize];
+static std::atomic<uint64_t> gDroppedSampleCount;
+static thread_local const volatile uint32_t* gThreadPc;
+
+static void RecordSample(uint32_t address)
+{
+    size_t index = uint32_t(address * 0x9E3779B1u) >> (32 - c_sampleTableBits);
+
+    for (size_t i = 0; i < c_sampleTableSize; i++)
+    {
+        auto& entry = gSampleTable[(index + i) & (c_sampleTableSize - 1)];
+
+        uint32_t entryAddress = entry.address.load(std::memory_order_relaxed);
+        if (entryAddress == 0 && entry.address.compare_exchange_strong(entryAddress, address, std::memory_order_relaxed))
+            entryAddress = address;
+
+        if (entryAddress == address)
+        {
+            entry.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    gDroppedSampleCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+#if !defined(_WIN32)
+static void SignalHandler(int)
+{
+    auto pc = gThreadPc;
+    if (pc != nullptr)
+    {
+        uint32_t address = *pc;
+
+        // Zero means the thread has not entered any guest code yet.
+        if (address != 0)
+            RecordSample(address);
+    }
+}
+#endif
+
+void GuestSampler::registerThread(const uint32_t* pc)
+{
+    gThreadPc = pc;
+}
+
+bool GuestSampler::start(uint32_t frequency)
+{
+#if defined(_WIN32)
+    return false;
+#else
+    if (frequency == 0)
+        return false;
+
+    struct sigaction action = {};
+    action.sa_handler = SignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, nullptr) != 0)
+        return false;
+
+    // ITIMER_PROF only advances while the process is running, so idle threads are not sampled.
+    uint32_t period = std::max(1000000u / frequency, 1u);
+
+    itimerval timer = {};
+    timer.it_interval.tv_sec = period / 1000000;
+    timer.it_interval.tv_usec = period % 1000000;
+    timer.it_value = timer.it_interval;
+
+    return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+#endif
+}
+
+void GuestSampler::stop()
+{
+#if !defined(_WIN32)
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+#endif
+}
+
+void GuestSampler::clear()
+{
+    for (auto& entry : gSampleTable)
+    {
+        entry.address.store(0, std::memory_order_relaxed);
+        entry.count.store(0, std::memory_order_relaxed);
+    }
+
+    gDroppedSampleCount.store(0, std::memory_order_relaxed);
+}
+
+std::vector<GuestSampler::Sample> GuestSampler::getSamples()
+{
+    std::vector<Sample> samples;
+
+    for (auto& entry : gSampleTable)
+    {
+        uint32_t address = entry.address.load(std::memory_order_relaxed);
+        if (address != 0)
+            samples.push_back({ address, entry.count.load(std::memory_order_relaxed) });
+    }
+
+    std::sort(samples.begin(), samples.end(), [](auto& lhs, auto& rhs) { return lhs.address < rhs.address; });
+    return samples;
+}
+
+uint64_t GuestSampler::getDroppedSampleCount()
+{
+    return gDroppedSampleCount.load(std::memory_order_relaxed);
+}
+
+std::vector<GuestSampler::FunctionSamples> GuestSampler::aggregate(std::vector<uint32_t> functions)
+{
+    std::sort(functions.begin(), functions.end());
+
+    std::unordered_map<uint32_t, FunctionSamples> functionSamples;
+
+    for (auto& sample : getSamples())
+    {
+        auto it = std::upper_bound(functions.begin(), functions.end(), sample.address);
+        if (it == functions.begin())
+            continue;
+
+        --it;
+
+        auto& function = functionSamples[*it];
+        function.address = *it;
+        function.count += sample.count;
+        function.blocks.push_back(sample);
+    }
+
+    std::vector<FunctionSamples> result;
+    result.reserve(functionSamples.size());
+
+    for (auto& [address, function] : functionSamples)
+    {
+        std::sort(function.blocks.begin(), function.blocks.end(), [](auto& lhs, auto& rhs) { return lhs.count > rhs.count; });
+        result.push_back(std::move(function));
+    }
+
+    std::sort(result.begin(), result.end(), [](auto& lhs, auto& rhs) { return lhs.count > rhs.count; });
+    return result;
+}
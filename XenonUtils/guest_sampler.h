@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Statistical profiler for recompiled code built with guest PC markers. A profiling timer periodically
+// interrupts the running thread and records the guest address stored in its marker. Currently only
+// implemented on POSIX platforms.
+struct GuestSampler
+{
+    struct Sample
+    {
+        uint32_t address;
+        uint64_t count;
+    };
+
+    struct FunctionSamples
+    {
+        uint32_t address;
+        uint64_t count;
+        std::vector<Sample> blocks;
+    };
+
+    // Sets the marker sampled while the calling thread is running, usually the pc field of its PPCContext.
+    // Passing nullptr stops sampling the calling thread.
+    static void registerThread(const uint32_t* pc);
+
+    static bool start(uint32_t frequency = 1000);
+    static void stop();
+    static void clear();
+
+    // Returns the sample count of every recorded marker value, sorted by address.
+    static std::vector<Sample> getSamples();
+
+    // Number of samples that were discarded because the sample table was full.
+    static uint64_t getDroppedSampleCount();
+
+    // Attributes the samples to the functions in the specified mapping table,
+    // which is terminated by an entry with a null host function like PPCFuncMappings.
+    template<typename TMapping>
+    static std::vector<FunctionSamples> aggregate(const TMapping* mappings)
+    {
+        std::vector<uint32_t> functions;
+        for (auto mapping = mappings; mapping->host != nullptr; ++mapping)
+            functions.push_back(uint32_t(mapping->guest));
+
+        return aggregate(std::move(functions));
+    }
+
+    // Attributes the samples to the functions starting at the specified guest addresses.
+    static std::vector<FunctionSamples> aggregate(std::vector<uint32_t> functions);
+};
@@ -1,6 +1,7 @@
 #include "image.h"
 #include "elf.h"
 #include "xex.h"
+#include "memory_mapped_file.h"
 #include <cassert>
 #include <cstring>
 
@@ -29,7 +30,7 @@ const Section* Image::Find(const std::string_view& name) const
     return nullptr;
 }
 
-Image Image::ParseImage(const uint8_t* data, size_t size)
+Image Image::ParseImage(const uint8_t* data, size_t size, bool verifyHashes)
 {
     if (data[0] == ELFMAG0 && data[1] == ELFMAG1 && data[2] == ELFMAG2 && data[3] == ELFMAG3)
     {
@@ -37,22 +38,58 @@ Image Image::ParseImage(const uint8_t* data, size_t size)
     }
     else if (data[0] == 'X' && data[1] == 'E' && data[2] == 'X' && data[3] == '2')
     {
-        return Xex2LoadImage(data, size);
+        return Xex2LoadImage(data, size, verifyHashes);
     }
 
     return {};
 }
 
-Image ElfLoadImage(const uint8_t* data, size_t size)
+Image Image::ParseImage(const std::filesystem::path& path, bool verifyHashes)
+{
+    // The loaders rewrite parts of the image in place, which a copy-on-write mapping allows without touching the file.
+    auto file = std::make_shared<MemoryMappedFile>();
+    if (!file->open(path, true) || file->size() < 4)
+    {
+        return {};
+    }
+
+    const uint8_t* data = file->data();
+    const size_t size = file->size();
+
+    if (data[0] == ELFMAG0 && data[1] == ELFMAG1 && data[2] == ELFMAG2 && data[3] == ELFMAG3)
+    {
+        return ElfLoadImage(data, size, std::move(file));
+    }
+    else if (data[0] == 'X' && data[1] == 'E' && data[2] == 'X' && data[3] == '2')
+    {
+        return Xex2LoadImage(data, size, verifyHashes, std::move(file));
+    }
+
+    return {};
+}
+
+Image ElfLoadImage(const uint8_t* data, size_t size, std::shared_ptr<MemoryMappedFile> file)
 {
     const auto* header = (elf32_hdr*)data;
     assert(header->e_ident[EI_DATA] == 2);
 
     Image image{};
     image.size = size;
-    image.data = std::make_unique<uint8_t[]>(size);
     image.entry_point = ByteSwap(header->e_entry);
-    memcpy(image.data.get(), data, size);
+
+    // The sections are stored as is, so a mapped file can be referenced directly.
+    uint8_t* imageData = nullptr;
+    if (file != nullptr)
+    {
+        imageData = file->data();
+        image.mapping = std::move(file);
+    }
+    else
+    {
+        image.data = std::make_unique<uint8_t[]>(size);
+        memcpy(image.data.get(), data, size);
+        imageData = image.data.get();
+    }
 
     auto stringTableIndex = ByteSwap(header->e_shstrndx);
 
@@ -92,7 +129,7 @@ Image ElfLoadImage(const uint8_t* data, size_t size)
         const auto rva = ByteSwap(section.sh_addr) - image.base;
         const auto size = ByteSwap(section.sh_size);
 
-        image.Map(name, rva, size, flags, image.data.get() + ByteSwap(section.sh_offset));
+        image.Map(name, rva, size, flags, imageData + ByteSwap(section.sh_offset));
     }
 
     return image;
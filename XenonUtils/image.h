@@ -1,13 +1,20 @@
 #pragma once
+#include <filesystem>
 #include <memory>
 #include <string>
 #include <set>
 #include <section.h>
 #include "symbol_table.h"
 
+struct MemoryMappedFile;
+
 struct Image
 {
     std::unique_ptr<uint8_t[]> data{};
+
+    // Keeps the memory the sections point to alive when it isn't owned by data, like a mapped input or cache file.
+    std::shared_ptr<void> mapping{};
+
     size_t base{};
     uint32_t size{};
 
@@ -41,9 +48,18 @@ struct Image
      * \brief Parse given data to an image, reallocates with ownership
      * \param data Pointer to data
      * \param size Size of data
+     * \param verifyHashes Whether to check the hashes of compressed XEX blocks
      * \return Parsed image
      */
-    static Image ParseImage(const uint8_t* data, size_t size);
+    static Image ParseImage(const uint8_t* data, size_t size, bool verifyHashes = true);
+
+    /**
+     * \brief Map the given file and parse it to an image, referencing the mapping instead of copying the parts stored as is
+     * \param path Path to file
+     * \param verifyHashes Whether to check the hashes of compressed XEX blocks
+     * \return Parsed image, empty if the file couldn't be mapped
+     */
+    static Image ParseImage(const std::filesystem::path& path, bool verifyHashes = true);
 };
 
-Image ElfLoadImage(const uint8_t* data, size_t size);
+Image ElfLoadImage(const uint8_t* data, size_t size, std::shared_ptr<MemoryMappedFile> file = {});
@@ -0,0 +1,225 @@
+#include "image_cache.h"
+#include "memory_mapped_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <xxhash.h>
+
+// "XIMC" in little endian.
+static constexpr uint32_t c_magic = 0x434D4958;
+
+// Needs to be incremented whenever the layout below or the way images are loaded changes.
+static constexpr uint32_t c_version = 1;
+
+static constexpr size_t c_dataAlignment = 0x1000;
+
+struct ImageCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    ImageCacheKey key;
+    uint64_t base;
+    uint64_t entryPoint;
+    uint64_t dataOffset;
+    uint32_t size;
+    uint32_t sectionCount;
+    uint32_t symbolCount;
+    uint32_t stringTableSize;
+};
+
+struct ImageCacheSection
+{
+    uint64_t base;
+    uint64_t dataOffset;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t nameOffset;
+};
+
+struct ImageCacheSymbol
+{
+    uint64_t address;
+    uint64_t size;
+    uint32_t type;
+    uint32_t nameOffset;
+};
+
+static void HashFile(XXH3_state_t* state, const std::filesystem::path& path)
+{
+    MemoryMappedFile file;
+    std::error_code ec;
+    uint64_t size = 0;
+
+    if (!path.empty() && std::filesystem::file_size(path, ec) != 0 && !ec && file.open(path))
+    {
+        size = file.size();
+        XXH3_128bits_update(state, file.data(), file.size());
+    }
+
+    // The size separates the two files, so moving bytes from one to the other changes the key.
+    XXH3_128bits_update(state, &size, sizeof(size));
+}
+
+ImageCacheKey ComputeImageCacheKey(const std::filesystem::path& filePath, const std::filesystem::path& patchFilePath)
+{
+    XXH3_state_t* state = XXH3_createState();
+    XXH3_128bits_reset(state);
+    HashFile(state, filePath);
+    HashFile(state, patchFilePath);
+
+    XXH128_hash_t hash = XXH3_128bits_digest(state);
+    XXH3_freeState(state);
+
+    return { hash.low64, hash.high64 };
+}
+
+bool SaveImageCache(const std::filesystem::path& path, const ImageCacheKey& key, const Image& image)
+{
+    if (image.data == nullptr)
+        return image.mapping != nullptr;
+
+    std::string strings;
+    auto addString = [&](const std::string& string)
+        {
+            uint32_t offset = uint32_t(strings.size());
+            strings += string;
+            strings += '\0';
+            return offset;
+        };
+
+    std::vector<ImageCacheSection> sections(image.sections.size());
+    auto sectionIt = sections.begin();
+
+    for (const auto& section : image.sections)
+    {
+        // Sections are restored relative to the image memory, so they must all point into it.
+        if (section.data < image.data.get() || section.data > image.data.get() + image.size)
+            return false;
+
+        sectionIt->base = section.base;
+        sectionIt->dataOffset = section.data - image.data.get();
+        sectionIt->size = section.size;
+        sectionIt->flags = section.flags;
+        sectionIt->nameOffset = addString(section.name);
+        ++sectionIt;
+    }
+
+    std::vector<ImageCacheSymbol> symbols(image.symbols.size());
+    auto symbolIt = symbols.begin();
+
+    for (const auto& symbol : image.symbols)
+    {
+        symbolIt->address = symbol.address;
+        symbolIt->size = symbol.size;
+        symbolIt->type = symbol.type;
+        symbolIt->nameOffset = addString(symbol.name);
+        ++symbolIt;
+    }
+
+    const size_t metadataSize = sizeof(ImageCacheHeader) + sections.size() * sizeof(ImageCacheSection) +
+        symbols.size() * sizeof(ImageCacheSymbol) + strings.size();
+
+    ImageCacheHeader header{};
+    header.magic = c_magic;
+    header.version = c_version;
+    header.key = key;
+    header.base = image.base;
+    header.entryPoint = image.entry_point;
+    header.dataOffset = (metadataSize + c_dataAlignment - 1) & ~(c_dataAlignment - 1);
+    header.size = image.size;
+    header.sectionCount = uint32_t(sections.size());
+    header.symbolCount = uint32_t(symbols.size());
+    header.stringTableSize = uint32_t(strings.size());
+
+    // Written next to the destination first, so other runs never map a partially written file.
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream stream(tempPath, std::ios::binary);
+        if (!stream.good())
+            return false;
+
+        std::vector<char> padding(header.dataOffset - metadataSize);
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(ImageCacheSection));
+        stream.write(reinterpret_cast<const char*>(symbols.data()), symbols.size() * sizeof(ImageCacheSymbol));
+        stream.write(strings.data(), strings.size());
+        stream.write(padding.data(), padding.size());
+        stream.write(reinterpret_cast<const char*>(image.data.get()), image.size);
+
+        if (!stream.good())
+            return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    return !ec;
+}
+
+bool LoadImageCache(const std::filesystem::path& path, const ImageCacheKey& key, Image& image)
+{
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+        return false;
+
+    auto file = std::make_shared<MemoryMappedFile>();
+    if (!file->open(path) || file->size() < sizeof(ImageCacheHeader))
+        return false;
+
+    const auto* header = reinterpret_cast<const ImageCacheHeader*>(file->data());
+
+    if (header->magic != c_magic || header->version != c_version || header->key.low != key.low || header->key.high != key.high)
+        return false;
+
+    const size_t metadataSize = sizeof(ImageCacheHeader) + size_t(header->sectionCount) * sizeof(ImageCacheSection) +
+        size_t(header->symbolCount) * sizeof(ImageCacheSymbol) + header->stringTableSize;
+
+    // The memory starts at the first aligned offset after the metadata and must fit in the file from there.
+    const size_t dataOffset = (metadataSize + c_dataAlignment - 1) & ~(c_dataAlignment - 1);
+    if (header->dataOffset != dataOffset || header->dataOffset > file->size() || header->size > file->size() - header->dataOffset)
+        return false;
+
+    const auto* sections = reinterpret_cast<const ImageCacheSection*>(header + 1);
+    const auto* symbols = reinterpret_cast<const ImageCacheSymbol*>(sections + header->sectionCount);
+    const auto* strings = reinterpret_cast<const char*>(symbols + header->symbolCount);
+
+    // Every name is null terminated, so the last one ends the table.
+    if (header->stringTableSize != 0 && strings[header->stringTableSize - 1] != '\0')
+        return false;
+
+    uint8_t* data = file->data() + header->dataOffset;
+
+    Image result{};
+    result.base = header->base;
+    result.size = header->size;
+    result.entry_point = header->entryPoint;
+
+    for (size_t i = 0; i < header->sectionCount; i++)
+    {
+        const auto& section = sections[i];
+        if (section.dataOffset > header->size || section.size > header->size - section.dataOffset || section.nameOffset >= header->stringTableSize)
+            return false;
+
+        result.sections.insert({ strings + section.nameOffset, section.base, section.size,
+            static_cast<SectionFlags>(section.flags), data + section.dataOffset });
+    }
+
+    // The symbols were written in order, so every one of them goes at the end without being merged.
+    result.symbols.reserve(header->symbolCount);
+    for (size_t i = 0; i < header->symbolCount; i++)
+    {
+        const auto& symbol = symbols[i];
+        if (symbol.nameOffset >= header->stringTableSize)
+            return false;
+
+        result.symbols.emplace(strings + symbol.nameOffset, symbol.address, symbol.size, static_cast<SymbolType>(symbol.type));
+    }
+
+    result.mapping = std::move(file);
+    image = std::move(result);
+
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include "image.h"
+
+// Identifies the input files an image was loaded from.
+struct ImageCacheKey
+{
+    uint64_t low{};
+    uint64_t high{};
+};
+
+// Hashes the XEX or ELF file, and the patch file if there is one, into the key of the image loaded from them.
+// Missing files are hashed as empty ones.
+ImageCacheKey ComputeImageCacheKey(const std::filesystem::path& filePath, const std::filesystem::path& patchFilePath = {});
+
+// Writes the memory, the sections and the symbols of a loaded image to a cache file. The memory is stored page aligned after
+// the metadata, so that the file can be mapped as is. Images referencing their mapped input file are already loaded without
+// any copies, so these are skipped and the function returns true without writing anything.
+bool SaveImageCache(const std::filesystem::path& path, const ImageCacheKey& key, const Image& image);
+
+// Maps a cache file and restores the image from it, with the sections pointing into the mapping. Fails if the file is missing,
+// malformed, or was written for other input files.
+bool LoadImageCache(const std::filesystem::path& path, const ImageCacheKey& key, Image& image);
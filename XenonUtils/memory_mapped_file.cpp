@@ -1,6 +1,7 @@
 #include "memory_mapped_file.h"
 
 #if !defined(_WIN32)
+#   include <cerrno>
 #   include <cstring>
 #   include <cstdio>
 #   include <fcntl.h>
@@ -12,9 +13,9 @@ MemoryMappedFile::MemoryMappedFile()
     // Default constructor.
 }
 
-MemoryMappedFile::MemoryMappedFile(const std::filesystem::path &path)
+MemoryMappedFile::MemoryMappedFile(const std::filesystem::path &path, bool copyOnWrite)
 {
-    open(path);
+    open(path, copyOnWrite);
 }
 
 MemoryMappedFile::~MemoryMappedFile()
@@ -45,7 +46,7 @@ MemoryMappedFile::MemoryMappedFile(MemoryMappedFile &&other)
 #endif
 }
 
-bool MemoryMappedFile::open(const std::filesystem::path &path)
+bool MemoryMappedFile::open(const std::filesystem::path &path, bool copyOnWrite)
 {
 #if defined(_WIN32)
     fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
@@ -64,7 +65,7 @@ bool MemoryMappedFile::open(const std::filesystem::path &path)
         return false;
     }
 
-    fileMappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    fileMappingHandle = CreateFileMappingW(fileHandle, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
     if (fileMappingHandle == nullptr)
     {
         fprintf(stderr, "CreateFileMappingW failed with error %lu.\n", GetLastError());
@@ -73,7 +74,7 @@ bool MemoryMappedFile::open(const std::filesystem::path &path)
         return false;
     }
 
-    fileView = MapViewOfFile(fileMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    fileView = MapViewOfFile(fileMappingHandle, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
     if (fileView == nullptr)
     {
         fprintf(stderr, "MapViewOfFile failed with error %lu.\n", GetLastError());
@@ -102,7 +103,7 @@ bool MemoryMappedFile::open(const std::filesystem::path &path)
         return false;
     }
 
-    fileView = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fileHandle, 0);
+    fileView = mmap(nullptr, fileSize, copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_PRIVATE, fileHandle, 0);
     if (fileView == MAP_FAILED)
     {
         fprintf(stderr, "mmap failed with error %s.\n", strerror(errno));
@@ -115,33 +116,107 @@ bool MemoryMappedFile::open(const std::filesystem::path &path)
 #endif
 }
 
+bool MemoryMappedFile::create(const std::filesystem::path &path, size_t size)
+{
+#if defined(_WIN32)
+    fileHandle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "CreateFileW failed with error %lu.\n", GetLastError());
+        fileHandle = nullptr;
+        return false;
+    }
+
+    // Creating the mapping extends the file to the mapping size.
+    fileSize.QuadPart = size;
+    fileMappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, nullptr);
+    if (fileMappingHandle == nullptr)
+    {
+        fprintf(stderr, "CreateFileMappingW failed with error %lu.\n", GetLastError());
+        close();
+        return false;
+    }
+
+    fileView = MapViewOfFile(fileMappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+    if (fileView == nullptr)
+    {
+        fprintf(stderr, "MapViewOfFile failed with error %lu.\n", GetLastError());
+        close();
+        return false;
+    }
+
+    return true;
+#else
+    fileHandle = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fileHandle == -1)
+    {
+        fprintf(stderr, "open for %s failed with error %s.\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Reserve the space up front where possible, as running out of it while writing to the mapping can't be handled.
+    fileSize = off_t(size);
+    int result = posix_fallocate(fileHandle, 0, fileSize);
+    if (result == EINVAL || result == EOPNOTSUPP)
+    {
+        result = ftruncate(fileHandle, fileSize) == 0 ? 0 : errno;
+    }
+
+    if (result != 0)
+    {
+        fprintf(stderr, "Resizing %s failed with error %s.\n", path.c_str(), strerror(result));
+        close();
+        return false;
+    }
+
+    fileView = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileHandle, 0);
+    if (fileView == MAP_FAILED)
+    {
+        fprintf(stderr, "mmap failed with error %s.\n", strerror(errno));
+        close();
+        return false;
+    }
+
+    return true;
+#endif
+}
+
 void MemoryMappedFile::close()
 {
 #if defined(_WIN32)
     if (fileView != nullptr)
     {
         UnmapViewOfFile(fileView);
+        fileView = nullptr;
     }
 
     if (fileMappingHandle != nullptr)
     {
         CloseHandle(fileMappingHandle);
+        fileMappingHandle = nullptr;
     }
 
     if (fileHandle != nullptr)
     {
         CloseHandle(fileHandle);
+        fileHandle = nullptr;
     }
+
+    fileSize.QuadPart = 0;
 #else
     if (fileView != MAP_FAILED)
     {
         munmap(fileView, fileSize);
+        fileView = MAP_FAILED;
     }
 
     if (fileHandle != -1)
     {
         ::close(fileHandle);
+        fileHandle = -1;
     }
+
+    fileSize = 0;
 #endif
 }
 
@@ -21,10 +21,15 @@ struct MemoryMappedFile {
 #endif
 
     MemoryMappedFile();
-    MemoryMappedFile(const std::filesystem::path &path);
+    MemoryMappedFile(const std::filesystem::path &path, bool copyOnWrite = false);
     MemoryMappedFile(MemoryMappedFile &&other);
     ~MemoryMappedFile();
-    bool open(const std::filesystem::path &path);
+
+    // Copy-on-write mappings can be written to without affecting the file, and only the written pages are copied.
+    bool open(const std::filesystem::path &path, bool copyOnWrite = false);
+
+    // Creates or truncates the file to the given size, zero-filled, and maps it so that writes go to the file.
+    bool create(const std::filesystem::path &path, size_t size);
     void close();
     bool isOpen() const;
     uint8_t *data() const;
@@ -25,12 +25,39 @@
 #define PPC_XSTRINGIFY(x) #x
 #define PPC_STRINGIFY(x) PPC_XSTRINGIFY(x)
 #define PPC_FUNC(x) void x(PPCContext& __restrict ctx, uint8_t* base)
+#ifdef PPC_CONFIG_MULTI_ISA
+// Every ISA level defines its own implementation functions, so they can't have C linkage.
+#define PPC_FUNC_IMPL(x) PPC_FUNC(x)
+#define PPC_HOT_FUNC_IMPL(x) __attribute__((hot)) PPC_FUNC(x)
+#define PPC_COLD_FUNC_IMPL(x) __attribute__((cold)) PPC_FUNC(x)
+#else
 #define PPC_FUNC_IMPL(x) extern "C" PPC_FUNC(x)
+#define PPC_HOT_FUNC_IMPL(x) extern "C" __attribute__((hot)) PPC_FUNC(x)
+#define PPC_COLD_FUNC_IMPL(x) extern "C" __attribute__((cold)) PPC_FUNC(x)
+#endif
 #define PPC_EXTERN_FUNC(x) extern PPC_FUNC(x)
 #define PPC_WEAK_FUNC(x) __attribute__((weak,noinline)) PPC_FUNC(x)
 
 #define PPC_FUNC_PROLOGUE() __builtin_assume(((size_t)base & 0x1F) == 0)
 
+// The recompiled code can be compiled once per ISA level, with the functions of every level being
+// defined in a namespace picked from the target the compiler was invoked for. The recompiler emits
+// PPCFuncMappings to point to the mappings of the best level the CPU supports.
+#ifdef PPC_CONFIG_MULTI_ISA
+#if defined(__AVX512F__) && defined(__AVX512VL__) && defined(__AVX512BW__) && defined(__AVX512DQ__) && defined(__AVX512VBMI__) && defined(__AVX512VBMI2__)
+#define PPC_ISA_NAMESPACE ppc_isa_avx512
+#elif defined(__AVX2__) && defined(__FMA__) && defined(__BMI2__)
+#define PPC_ISA_NAMESPACE ppc_isa_avx2
+#else
+#define PPC_ISA_NAMESPACE ppc_isa_sse
+#endif
+#define PPC_ISA_NAMESPACE_BEGIN namespace PPC_ISA_NAMESPACE {
+#define PPC_ISA_NAMESPACE_END }
+#else
+#define PPC_ISA_NAMESPACE_BEGIN
+#define PPC_ISA_NAMESPACE_END
+#endif
+
 #ifndef PPC_LOAD_U8
 #define PPC_LOAD_U8(x) *(volatile uint8_t*)(base + (x))
 #endif
@@ -107,12 +134,22 @@
 
 #define PPC_MEMORY_SIZE 0x100000000ull
 
+#ifdef PPC_CONFIG_SPARSE_FUNC_TABLE
+#define PPC_LOOKUP_FUNC(x, y) PPCFuncTable[PPCFuncIndex(uint32_t(y))]
+#else
 #define PPC_LOOKUP_FUNC(x, y) *(PPCFunc**)(x + PPC_IMAGE_BASE + PPC_IMAGE_SIZE + (uint64_t(uint32_t(y) - PPC_CODE_BASE) * 2))
+#endif
 
 #ifndef PPC_CALL_INDIRECT_FUNC
 #define PPC_CALL_INDIRECT_FUNC(x) (PPC_LOOKUP_FUNC(base, x))(ctx, base)
 #endif
 
+// The marker is stored through a volatile pointer so consecutive stores don't get merged,
+// as it can be read asynchronously by a sampling profiler.
+#ifndef PPC_SET_GUEST_PC
+#define PPC_SET_GUEST_PC(x) (*(volatile uint32_t*)&ctx.pc = (x))
+#endif
+
 typedef void PPCFunc(struct PPCContext& __restrict__ ctx, uint8_t* base);
 
 struct PPCFuncMapping
@@ -121,7 +158,82 @@ struct PPCFuncMapping
     PPCFunc* host;
 };
 
+#ifdef PPC_CONFIG_MULTI_ISA
+extern PPCFuncMapping* PPCFuncMappings;
+#else
 extern PPCFuncMapping PPCFuncMappings[];
+#endif
+
+#ifdef PPC_CONFIG_PROFILE
+extern uint64_t PPCProfileFuncCounters[];
+extern uint64_t PPCProfileBlockCounters[];
+extern uint64_t PPCProfileIndirectTargets[];
+extern const size_t PPCProfileFuncCount;
+extern const size_t PPCProfileBlockCount;
+extern const size_t PPCProfileIndirectCount;
+
+// Writes the function counters, the block counters and the last indirect call targets to the specified file.
+bool PPCProfileSave(const char* path);
+
+// The counters are not incremented atomically. Entries from threads racing on
+// the same counter might get lost, which is acceptable for finding hot code.
+#ifndef PPC_PROFILE_FUNC
+#define PPC_PROFILE_FUNC(x) ++PPCProfileFuncCounters[x]
+#endif
+
+#ifndef PPC_PROFILE_BLOCK
+#define PPC_PROFILE_BLOCK(x) ++PPCProfileBlockCounters[x]
+#endif
+
+#ifndef PPC_PROFILE_INDIRECT
+#define PPC_PROFILE_INDIRECT(x, y) PPCProfileIndirectTargets[x] = (y)
+#endif
+#endif
+
+// Every ISA level has its own copy of the functions below, so they must never be called out of line,
+// as the linker could otherwise pick a copy using instructions the CPU doesn't support.
+#if defined(PPC_CONFIG_MULTI_ISA) && defined(__clang__)
+#pragma clang attribute push (__attribute__((always_inline)), apply_to = function)
+#endif
+
+#ifdef PPC_CONFIG_SPARSE_FUNC_TABLE
+// The function table only has entries for the addresses set in the bitmap, which has a bit for every
+// instruction in the code sections. The ranks store the number of set bits preceding every word.
+#ifdef PPC_CONFIG_FUNC_TABLE_BLOB
+extern const uint64_t* PPCFuncBitmap;
+extern const uint32_t* PPCFuncRanks;
+
+// Maps the bitmap and ranks from the ppc_func_table.bin file output by the recompiler.
+// This must succeed before any function is looked up.
+bool PPCFuncTableLoad(const char* path);
+#else
+extern const uint64_t PPCFuncBitmap[];
+extern const uint32_t PPCFuncRanks[];
+#endif
+
+// The table is initialized with the recompiled functions, so it doesn't need to be filled at startup.
+#ifdef PPC_CONFIG_MULTI_ISA
+extern PPCFunc** PPCFuncTable;
+#else
+extern PPCFunc* PPCFuncTable[];
+#endif
+
+// Counts the set bits up to and including the address, which gives the 1-based index of its entry.
+// Addresses without a bit set are mapped to the null entry at index 0 instead, as are the ones outside
+// of the code sections, like data pointers, which have no bit in the bitmap. Those are clamped to the
+// start of the bitmap rather than branched on, so the lookup stays branch-free.
+inline size_t PPCFuncIndex(uint32_t address)
+{
+    uint32_t offset = address - uint32_t(PPC_CODE_BASE);
+    uint32_t inRange = offset < uint32_t(PPC_CODE_SIZE);
+    offset &= -inRange;
+
+    uint32_t index = offset >> 2;
+    uint32_t bit = index & 63;
+    uint64_t word = PPCFuncBitmap[index >> 6];
+    return (PPCFuncRanks[index >> 6] + __builtin_popcountll(word & ((2ull << bit) - 1))) * ((word >> bit) & 1) * inRange;
+}
+#endif
 
 union PPCRegister
 {
@@ -191,6 +303,38 @@ struct PPCCRRegister
     }
 };
 
+// The CR fields laid out contiguously, allowing the entire register to be read and written
+// with a few 64-bit operations instead of one operation per bit.
+struct PPCCRFields
+{
+    uint64_t u64[4];
+
+    inline uint32_t get() const noexcept
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; i++)
+        {
+            // Every byte is either 0 or 1, so the multiplication gathers them to the top byte without any carries.
+            value |= uint32_t((__builtin_bswap64(u64[i]) * 0x0102040810204080ull) >> 56) << (24 - i * 8);
+        }
+        return value;
+    }
+
+    inline void set(uint32_t value, uint32_t fieldMask) noexcept
+    {
+        for (size_t i = 0; i < 4; i++)
+        {
+            uint64_t mask = ((fieldMask & (0x80 >> (i * 2))) != 0 ? 0x00000000FFFFFFFFull : 0) | 
+                ((fieldMask & (0x40 >> (i * 2))) != 0 ? 0xFFFFFFFF00000000ull : 0);
+
+            // Spreads the bits of the byte to the lowest bit of each byte, starting from the highest bit.
+            uint64_t bits = ((((value >> (24 - i * 8)) & 0xFF) * 0x8040201008040201ull) >> 7) & 0x0101010101010101ull;
+
+            u64[i] = (u64[i] & ~mask) | (bits & mask);
+        }
+    }
+};
+
 union alignas(0x10) PPCVRegister
 {
     int8_t s8[16];
@@ -322,7 +466,27 @@ struct alignas(0x40) PPCContext
 #ifndef PPC_CONFIG_SKIP_MSR
     uint32_t msr = 0x200A000;
 #endif
+#ifdef PPC_CONFIG_GUEST_PC
+    uint32_t pc = 0;
+#endif
 #ifndef PPC_CONFIG_CR_AS_LOCAL
+#ifdef PPC_CONFIG_PACKED_CR
+    union
+    {
+        struct
+        {
+            PPCCRRegister cr0;
+            PPCCRRegister cr1;
+            PPCCRRegister cr2;
+            PPCCRRegister cr3;
+            PPCCRRegister cr4;
+            PPCCRRegister cr5;
+            PPCCRRegister cr6;
+            PPCCRRegister cr7;
+        };
+        PPCCRFields cr;
+    };
+#else
     PPCCRRegister cr0;
     PPCCRRegister cr1;
     PPCCRRegister cr2;
@@ -331,6 +495,7 @@ struct alignas(0x40) PPCContext
     PPCCRRegister cr5;
     PPCCRRegister cr6;
     PPCCRRegister cr7;
+#endif
 #endif
     PPCFPSCRRegister fpscr;
 
@@ -606,6 +771,9 @@ inline __m128i _mm_avg_epi16(__m128i a, __m128i b)
 
 inline __m128 _mm_cvtepu32_ps_(__m128i src1)
 {
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+    return _mm_cvtepu32_ps(src1);
+#else
     __m128i xmm1 = _mm_add_epi32(src1, _mm_set1_epi32(127));
     __m128i xmm0 = _mm_slli_epi32(src1, 31 - 8);
     xmm0 = _mm_srli_epi32(xmm0, 31);
@@ -614,41 +782,117 @@ inline __m128 _mm_cvtepu32_ps_(__m128i src1)
     xmm0 = _mm_add_epi32(xmm0, _mm_set1_epi32(0x4F800000));
     __m128 xmm2 = _mm_cvtepi32_ps(src1);
     return _mm_blendv_ps(xmm2, _mm_castsi128_ps(xmm0), _mm_castsi128_ps(src1));
+#endif
 }
 
 inline __m128i _mm_perm_epi8_(__m128i a, __m128i b, __m128i c)
 {
     __m128i d = _mm_set1_epi8(0xF);
+#if defined(__AVX512VBMI__) && defined(__AVX512VL__)
+    // Flipping the lower 4 bits accounts for the vector reversal, and the 5th bit selects between the sources.
+    return _mm_permutex2var_epi8(a, _mm_xor_si128(c, d), b);
+#else
     __m128i e = _mm_sub_epi8(d, _mm_and_si128(c, d));
     return _mm_blendv_epi8(_mm_shuffle_epi8(a, e), _mm_shuffle_epi8(b, e), _mm_slli_epi32(c, 3));
+#endif
 }
 
 inline __m128i _mm_cmpgt_epu8(__m128i a, __m128i b)
 {
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+    return _mm_movm_epi8(_mm_cmpgt_epu8_mask(a, b));
+#else
     __m128i c = _mm_set1_epi8(char(128));
     return _mm_cmpgt_epi8(_mm_xor_si128(a, c), _mm_xor_si128(b, c));
+#endif
 }
 
 inline __m128i _mm_cmpgt_epu16(__m128i a, __m128i b)
 {
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+    return _mm_movm_epi16(_mm_cmpgt_epu16_mask(a, b));
+#else
     __m128i c = _mm_set1_epi16(short(32768));
     return _mm_cmpgt_epi16(_mm_xor_si128(a, c), _mm_xor_si128(b, c));
+#endif
 }
 
 inline __m128i _mm_vctsxs(__m128 src1)
 {
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+    // NaN converts to 0, and positive overflow saturates instead of producing the integer indefinite value.
+    __m128i dest = _mm_maskz_cvttps_epi32(_mm_cmp_ps_mask(src1, src1, _CMP_ORD_Q), src1);
+    return _mm_mask_blend_epi32(_mm_cmp_ps_mask(src1, _mm_set1_ps(2147483648.0f), _CMP_GE_OQ), dest, _mm_set1_epi32(INT_MAX));
+#else
     __m128 xmm2 = _mm_cmpunord_ps(src1, src1);
     __m128i xmm0 = _mm_cvttps_epi32(src1);
     __m128i xmm1 = _mm_cmpeq_epi32(xmm0, _mm_set1_epi32(INT_MIN));
     xmm1 = _mm_andnot_si128(_mm_castps_si128(src1), xmm1);
     __m128 dest = _mm_blendv_ps(_mm_castsi128_ps(xmm0), _mm_castsi128_ps(_mm_set1_epi32(INT_MAX)), _mm_castsi128_ps(xmm1));
     return _mm_andnot_si128(_mm_castps_si128(xmm2), _mm_castps_si128(dest));
+#endif
 }
 
 inline __m128i _mm_vsr(__m128i a, __m128i b)
 {
     b = _mm_srli_epi64(_mm_slli_epi64(b, 61), 61);
+#if defined(__AVX512VBMI2__) && defined(__AVX512VL__)
+    return _mm_shrdv_epi64(a, _mm_unpackhi_epi64(a, _mm_setzero_si128()), _mm_broadcastq_epi64(b));
+#else
     return _mm_castps_si128(_mm_insert_ps(_mm_castsi128_ps(_mm_srl_epi64(a, b)), _mm_castsi128_ps(_mm_srl_epi64(_mm_srli_si128(a, 4), b)), 0x10));
+#endif
 }
 
+inline __m128i _mm_vslw(__m128i a, __m128i b)
+{
+    b = _mm_and_si128(b, _mm_set1_epi32(0x1F));
+#ifdef __AVX2__
+    return _mm_sllv_epi32(a, b);
+#else
+    alignas(16) uint32_t values[4];
+    alignas(16) uint32_t shifts[4];
+    _mm_store_si128((__m128i*)values, a);
+    _mm_store_si128((__m128i*)shifts, b);
+    for (size_t i = 0; i < 4; i++)
+        values[i] <<= shifts[i];
+    return _mm_load_si128((__m128i*)values);
+#endif
+}
+
+inline __m128i _mm_vsrw(__m128i a, __m128i b)
+{
+    b = _mm_and_si128(b, _mm_set1_epi32(0x1F));
+#ifdef __AVX2__
+    return _mm_srlv_epi32(a, b);
+#else
+    alignas(16) uint32_t values[4];
+    alignas(16) uint32_t shifts[4];
+    _mm_store_si128((__m128i*)values, a);
+    _mm_store_si128((__m128i*)shifts, b);
+    for (size_t i = 0; i < 4; i++)
+        values[i] >>= shifts[i];
+    return _mm_load_si128((__m128i*)values);
+#endif
+}
+
+inline __m128i _mm_vsraw(__m128i a, __m128i b)
+{
+    b = _mm_and_si128(b, _mm_set1_epi32(0x1F));
+#ifdef __AVX2__
+    return _mm_srav_epi32(a, b);
+#else
+    alignas(16) int32_t values[4];
+    alignas(16) uint32_t shifts[4];
+    _mm_store_si128((__m128i*)values, a);
+    _mm_store_si128((__m128i*)shifts, b);
+    for (size_t i = 0; i < 4; i++)
+        values[i] >>= shifts[i];
+    return _mm_load_si128((__m128i*)values);
+#endif
+}
+
+#if defined(PPC_CONFIG_MULTI_ISA) && defined(__clang__)
+#pragma clang attribute pop
+#endif
+
 #endif
@@ -0,0 +1,122 @@
+#include "sha1_hash.h"
+
+#include <cstring>
+#include <TinySHA1.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#   define SHA1_HASH_X86
+#   include <immintrin.h>
+#endif
+
+static constexpr size_t c_blockSize = 64;
+
+#ifdef SHA1_HASH_X86
+
+// Every register holds four words of the message schedule, and every SHA1RNDS4 performs four rounds,
+// using the round function selected by its immediate, which changes every 20 rounds.
+__attribute__((target("sha,ssse3,sse4.1")))
+static void ProcessBlocks(uint32_t* state, const uint8_t* data, size_t blockCount)
+{
+    const __m128i byteSwapMask = _mm_set_epi64x(0x0001020304050607ull, 0x08090A0B0C0D0E0Full);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+    __m128i e = _mm_set_epi32(int(state[4]), 0, 0, 0);
+
+    for (size_t block = 0; block < blockCount; block++, data += c_blockSize)
+    {
+        __m128i schedule[20];
+        for (size_t i = 0; i < 4; i++)
+            schedule[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)), byteSwapMask);
+
+        for (size_t i = 4; i < 20; i++)
+            schedule[i] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(schedule[i - 4], schedule[i - 3]), schedule[i - 2]), schedule[i - 1]);
+
+        __m128i abcdSaved = abcd;
+        __m128i eSaved = e;
+
+        __m128i previous = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, _mm_add_epi32(e, schedule[0]), 0);
+
+        for (size_t i = 1; i < 5; i++)
+        {
+            __m128i next = _mm_sha1nexte_epu32(previous, schedule[i]);
+            previous = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, next, 0);
+        }
+
+        for (size_t i = 5; i < 10; i++)
+        {
+            __m128i next = _mm_sha1nexte_epu32(previous, schedule[i]);
+            previous = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, next, 1);
+        }
+
+        for (size_t i = 10; i < 15; i++)
+        {
+            __m128i next = _mm_sha1nexte_epu32(previous, schedule[i]);
+            previous = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, next, 2);
+        }
+
+        for (size_t i = 15; i < 20; i++)
+        {
+            __m128i next = _mm_sha1nexte_epu32(previous, schedule[i]);
+            previous = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, next, 3);
+        }
+
+        e = _mm_sha1nexte_epu32(previous, eSaved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = uint32_t(_mm_extract_epi32(e, 3));
+}
+
+static void HashShaNi(const uint8_t* data, size_t size, uint8_t* digest)
+{
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    size_t blockCount = size / c_blockSize;
+    ProcessBlocks(state, data, blockCount);
+
+    // The padding is a set bit after the message, followed by the message length in bits at the end of the last block.
+    uint8_t tail[c_blockSize * 2]{};
+    size_t tailSize = size % c_blockSize;
+    memcpy(tail, data + blockCount * c_blockSize, tailSize);
+    tail[tailSize] = 0x80;
+
+    size_t tailBlockCount = tailSize < c_blockSize - 8 ? 1 : 2;
+    uint64_t bitCount = uint64_t(size) * 8;
+    for (size_t i = 0; i < 8; i++)
+        tail[tailBlockCount * c_blockSize - 1 - i] = uint8_t(bitCount >> (i * 8));
+
+    ProcessBlocks(state, tail, tailBlockCount);
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        digest[i * 4 + 0] = uint8_t(state[i] >> 24);
+        digest[i * 4 + 1] = uint8_t(state[i] >> 16);
+        digest[i * 4 + 2] = uint8_t(state[i] >> 8);
+        digest[i * 4 + 3] = uint8_t(state[i]);
+    }
+}
+
+#endif
+
+void Sha1Hash(const void* data, size_t size, uint8_t* digest)
+{
+#ifdef SHA1_HASH_X86
+    static const bool s_hasShaNi = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+
+    if (s_hasShaNi)
+    {
+        HashShaNi(reinterpret_cast<const uint8_t*>(data), size, digest);
+        return;
+    }
+#endif
+
+    sha1::SHA1 s;
+    s.processBytes(data, size);
+    s.finalize(digest);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Computes the SHA-1 digest of the data. Uses the SHA instructions when the CPU supports them, and falls back to TinySHA1 otherwise.
+void Sha1Hash(const void* data, size_t size, uint8_t* digest);
@@ -1,63 +1,195 @@
 #pragma once
 #include "symbol.h"
-#include <set>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
-class SymbolTable : public std::multiset<Symbol, SymbolComparer>
+// Symbols sorted by address in a flat array, where the ones at the same address stay in insertion order.
+// The array is split in sorted runs, each one holding the symbols inserted after the ones before it. A symbol is
+// appended to the last run when it doesn't come before its end, otherwise it starts a new run. The last two runs
+// are merged whenever the last one grows to a quarter of the one before, so there are only logarithmically many of them
+// and the analysis can keep adding functions without moving the whole table every time. Lookups binary search
+// every run, while iterating merges them into one first. Like with a vector, inserting or erasing invalidates iterators.
+class SymbolTable
 {
 public:
-    const_iterator find(size_t address) const
+    using iterator = std::vector<Symbol>::iterator;
+    using const_iterator = std::vector<Symbol>::const_iterator;
+
+    // Merging sooner keeps fewer runs to search, at the cost of moving the symbols more often.
+    static constexpr size_t c_runSizeRatio = 4;
+
+    template<typename... Args>
+    iterator emplace(Args&&... args)
     {
-        auto [beginIt, endIt] = equal_range(address);
-        if (beginIt == endIt)
+        const size_t address = symbols.emplace_back(std::forward<Args>(args)...).address;
+        if (runStarts.empty() || symbols[symbols.size() - 2].address > address)
         {
-            return end();
+            runStarts.push_back(symbols.size() - 1);
         }
 
-        size_t closest{ address - beginIt->address };
-        auto match = end();
-        for (auto it = beginIt; it != endIt; ++it)
+        while (runStarts.size() >= 2 && (symbols.size() - runStarts.back()) * c_runSizeRatio >= runStarts.back() - runStarts[runStarts.size() - 2])
         {
-            if (address < it->address || address >= it->address + it->size)
-            {
-                continue;
-            }
+            MergeLastRuns();
+        }
 
-            const size_t distance = address - it->address;
-            if (distance <= closest)
-            {
-                match = it;
-                closest = distance;
-            }
+        // Being the newest, the symbol comes after every other one at its address in the last run.
+        return std::upper_bound(symbols.begin() + runStarts.back(), symbols.end(), address, SymbolComparer{}) - 1;
+    }
+
+    iterator insert(Symbol symbol)
+    {
+        return emplace(std::move(symbol));
+    }
+
+    iterator erase(const_iterator position)
+    {
+        // Every run starting after the symbol moves down by one, and the run it was in goes away if it was alone in it.
+        const size_t index = position - symbols.cbegin();
+        auto run = std::upper_bound(runStarts.begin(), runStarts.end(), index);
+        for (auto it = run; it != runStarts.end(); ++it)
+        {
+            --*it;
+        }
+
+        const size_t runEnd = run != runStarts.end() ? *run : symbols.size() - 1;
+        if (*std::prev(run) == runEnd)
+        {
+            runStarts.erase(std::prev(run));
         }
 
-        return match;
+        return symbols.erase(position);
     }
 
-    iterator find(size_t address)
+    template<typename Predicate>
+    size_t erase_if(Predicate predicate)
     {
-        auto [beginIt, endIt] = equal_range(address);
-        if (beginIt == endIt)
+        Merge();
+        auto it = std::remove_if(symbols.begin(), symbols.end(), predicate);
+        size_t count = symbols.end() - it;
+        symbols.erase(it, symbols.end());
+        if (symbols.empty())
         {
-            return end();
+            runStarts.clear();
         }
 
-        size_t closest{ address - beginIt->address };
-        auto match = end();
-        for (auto it = beginIt; it != endIt; ++it)
+        return count;
+    }
+
+    void reserve(size_t count)
+    {
+        symbols.reserve(count);
+    }
+
+    size_t size() const
+    {
+        return symbols.size();
+    }
+
+    bool empty() const
+    {
+        return symbols.empty();
+    }
+
+    iterator begin()
+    {
+        Merge();
+        return symbols.begin();
+    }
+
+    const_iterator begin() const
+    {
+        Merge();
+        return symbols.begin();
+    }
+
+    iterator end()
+    {
+        return symbols.end();
+    }
+
+    const_iterator end() const
+    {
+        return symbols.end();
+    }
+
+    // The last symbol inserted at the address, skipping the ones without a size.
+    const_iterator find(size_t address) const
+    {
+        return FindLast(address, address);
+    }
+
+    iterator find(size_t address)
+    {
+        return symbols.begin() + (std::as_const(*this).find(address) - symbols.cbegin());
+    }
+
+    // The symbol starting closest before the address, if it contains it. Symbols are expected not to overlap,
+    // like the functions found by the analysis, so the ones starting further away aren't considered.
+    const_iterator find_containing(size_t address) const
+    {
+        bool found = false;
+        size_t start = 0;
+        for (size_t i = 0; i < runStarts.size(); i++)
         {
-            if (address < it->address || address >= it->address + it->size)
+            auto runBegin = symbols.cbegin() + runStarts[i];
+            auto it = std::upper_bound(runBegin, GetRunEnd(i), address, SymbolComparer{});
+            if (it != runBegin && (!found || std::prev(it)->address > start))
             {
-                continue;
+                found = true;
+                start = std::prev(it)->address;
             }
+        }
+
+        return found ? FindLast(start, address) : symbols.end();
+    }
 
-            const size_t distance = address - it->address;
-            if (distance <= closest)
+    iterator find_containing(size_t address)
+    {
+        return symbols.begin() + (std::as_const(*this).find_containing(address) - symbols.cbegin());
+    }
+
+private:
+    // Merging only reorders the symbols, so the table is still logically the same when it's const.
+    mutable std::vector<Symbol> symbols;
+    mutable std::vector<size_t> runStarts;
+
+    const_iterator GetRunEnd(size_t run) const
+    {
+        return run + 1 < runStarts.size() ? symbols.cbegin() + runStarts[run + 1] : symbols.cend();
+    }
+
+    // The merge is stable, so the symbols of the last run still come after the ones at the same address before them.
+    void MergeLastRuns() const
+    {
+        std::inplace_merge(symbols.begin() + runStarts[runStarts.size() - 2], symbols.begin() + runStarts.back(), symbols.end(), SymbolComparer{});
+        runStarts.pop_back();
+    }
+
+    void Merge() const
+    {
+        while (runStarts.size() > 1)
+        {
+            MergeLastRuns();
+        }
+    }
+
+    // The last symbol at the start address which contains the address, searching the runs from the newest one.
+    const_iterator FindLast(size_t start, size_t address) const
+    {
+        for (size_t i = runStarts.size(); i-- > 0;)
+        {
+            auto [beginIt, endIt] = std::equal_range(symbols.cbegin() + runStarts[i], GetRunEnd(i), start, SymbolComparer{});
+            for (auto it = endIt; it != beginIt;)
             {
-                match = it;
-                closest = distance;
+                --it;
+                if (address < it->address + it->size)
+                {
+                    return it;
+                }
             }
         }
 
-        return match;
+        return symbols.end();
     }
 };
@@ -1,11 +1,15 @@
 #include "xex.h"
 #include "image.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstring>
+#include <future>
 #include <vector>
+#include <thread>
 #include <unordered_map>
-#include <aes.hpp>
-#include <TinySHA1.hpp>
+#include <aes_cbc.h>
+#include <sha1_hash.h>
 #include <xex_patcher.h>
 
 #define STRINGIFY(X) #X
@@ -124,7 +128,66 @@ std::unordered_map<size_t, const char*> XboxKernelExports =
     #include "xbox/xboxkrnl_table.inc"
 };
 
-Image Xex2LoadImage(const uint8_t* data, size_t dataSize)
+// The chain is walked first to find all the blocks, as the hashes don't depend on each other and can be checked on
+// several threads at once. Every block is checked against the hash stored in the previous one, so a corrupted size
+// can only make the walk stop early or go out of bounds, both of which fail the verification.
+bool Xex2VerifyCompressedBlocks(const uint8_t* data, size_t dataSize, const Xex2CompressedBlockInfo* blockInfo)
+{
+    struct CompressedBlock
+    {
+        const uint8_t* data;
+        size_t size;
+        const uint8_t* hash;
+    };
+
+    std::vector<CompressedBlock> blocks;
+    const uint8_t* p = data;
+    const uint8_t* end = data + dataSize;
+
+    while (blockInfo->blockSize)
+    {
+        const size_t blockSize = blockInfo->blockSize;
+        if (blockSize < sizeof(Xex2CompressedBlockInfo) || blockSize > size_t(end - p))
+            return false;
+
+        blocks.push_back({ p, blockSize, blockInfo->blockHash });
+
+        blockInfo = reinterpret_cast<const Xex2CompressedBlockInfo*>(p);
+        p += blockSize;
+    }
+
+    std::atomic<size_t> nextBlock = 0;
+    std::atomic<bool> failed = false;
+
+    auto verifyBlocks = [&]()
+        {
+            uint8_t digest[0x14];
+            size_t i;
+
+            while (!failed && (i = nextBlock++) < blocks.size())
+            {
+                Sha1Hash(blocks[i].data, blocks[i].size, digest);
+
+                if (memcmp(digest, blocks[i].hash, sizeof(digest)) != 0)
+                    failed = true;
+            }
+        };
+
+    size_t threadCount = std::min<size_t>(std::thread::hardware_concurrency(), blocks.size());
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+        threads.emplace_back(verifyBlocks);
+
+    verifyBlocks();
+
+    for (auto& thread : threads)
+        thread.join();
+
+    return !failed;
+}
+
+Image Xex2LoadImage(const uint8_t* data, size_t dataSize, bool verifyHashes, std::shared_ptr<MemoryMappedFile> file)
 {
     auto* header = reinterpret_cast<const Xex2Header*>(data);
     auto* security = reinterpret_cast<const Xex2SecurityInfo*>(data + header->securityOffset);
@@ -132,6 +195,7 @@ Image Xex2LoadImage(const uint8_t* data, size_t dataSize)
 
     Image image{};
     std::unique_ptr<uint8_t[]> result{};
+    uint8_t* imageData = nullptr;
     size_t imageSize = security->imageSize;
 
     // Decompress image
@@ -145,17 +209,13 @@ Image Xex2LoadImage(const uint8_t* data, size_t dataSize)
         if (fileFormatInfo->encryptionType == XEX_ENCRYPTION_NORMAL)
         {
             constexpr uint32_t KeySize = 16;
-            AES_ctx aesContext;
 
             uint8_t decryptedKey[KeySize];
-            memcpy(decryptedKey, security->aesKey, KeySize);
-            AES_init_ctx_iv(&aesContext, Xex2RetailKey, AESBlankIV);
-            AES_CBC_decrypt_buffer(&aesContext, decryptedKey, KeySize);
+            AesCbcDecrypt(Xex2RetailKey, AESBlankIV, reinterpret_cast<const uint8_t*>(security->aesKey), decryptedKey, KeySize);
 
             decryptedData = std::make_unique<uint8_t[]>(dataSize - header->headerSize);
-            memcpy(decryptedData.get(), data + header->headerSize, dataSize - header->headerSize);
-            AES_init_ctx_iv(&aesContext, decryptedKey, AESBlankIV);
-            AES_CBC_decrypt_buffer(&aesContext, decryptedData.get(), dataSize - header->headerSize);
+            AesCbcDecrypt(decryptedKey, AESBlankIV, data + header->headerSize, decryptedData.get(), dataSize - header->headerSize,
+                std::thread::hardware_concurrency());
 
             srcData = decryptedData.get();
         }
@@ -166,8 +226,16 @@ Image Xex2LoadImage(const uint8_t* data, size_t dataSize)
 
         if (fileFormatInfo->compressionType == XEX_COMPRESSION_NONE)
         {
-            result = std::make_unique<uint8_t[]>(imageSize);
-            memcpy(result.get(), srcData, imageSize);
+            if (file != nullptr && decryptedData == nullptr && imageSize <= dataSize - header->headerSize)
+            {
+                imageData = const_cast<uint8_t*>(srcData);
+                image.mapping = std::move(file);
+            }
+            else
+            {
+                result = std::make_unique<uint8_t[]>(imageSize);
+                memcpy(result.get(), srcData, imageSize);
+            }
         }
         else if (fileFormatInfo->compressionType == XEX_COMPRESSION_BASIC)
         {
@@ -197,72 +265,34 @@ Image Xex2LoadImage(const uint8_t* data, size_t dataSize)
         else if (fileFormatInfo->compressionType == XEX_COMPRESSION_NORMAL)
         {
             result = std::make_unique<uint8_t[]>(imageSize);
-            auto* destData = result.get();
-
-            const Xex2CompressedBlockInfo* blocks = &((const Xex2FileNormalCompressionInfo*)(fileFormatInfo + 1))->firstBlock;
-            const uint32_t headerSize = header->headerSize.get();
 
-            const uint32_t exeLength = dataSize - headerSize;
-            const uint8_t* exeBuffer = srcData;
+            const auto* compressionInfo = reinterpret_cast<const Xex2FileNormalCompressionInfo*>(fileFormatInfo + 1);
+            const size_t exeLength = dataSize - header->headerSize;
 
-            auto compressBuffer = std::make_unique<uint8_t[]>(exeLength);
-            const uint8_t* p = NULL;
-            uint8_t* d = NULL;
-            sha1::SHA1 s;
+            // The chunks are decompressed straight from the blocks, so the hashes can be verified on other threads
+            // in the meantime. The decompressed image is discarded if any of them doesn't match.
+            std::future<bool> verified;
+            if (verifyHashes)
+                verified = std::async(std::launch::async, Xex2VerifyCompressedBlocks, srcData, exeLength, &compressionInfo->firstBlock);
 
-            p = exeBuffer;
-            d = compressBuffer.get();
+            int resultCode = lzxDecompressBlocks(srcData, exeLength, compressionInfo->firstBlock.blockSize, result.get(), imageSize, compressionInfo->windowSize);
 
-            uint8_t blockCalcedDigest[0x14];
-            while (blocks->blockSize) 
-            {
-                const uint8_t* pNext = p + blocks->blockSize;
-                const auto* nextBlock = (const Xex2CompressedBlockInfo*)p;
-
-                s.reset();
-                s.processBytes(p, blocks->blockSize);
-                s.finalize(blockCalcedDigest);
-
-                if (memcmp(blockCalcedDigest, blocks->blockHash, 0x14) != 0)
-                    return {};
-
-                p += 4;
-                p += 20;
-
-                while (true) 
-                {
-                    const size_t chunkSize = (p[0] << 8) | p[1];
-                    p += 2;
-
-                    if (!chunkSize)
-                        break;
-
-                    memcpy(d, p, chunkSize);
-                    p += chunkSize;
-                    d += chunkSize;
-                }
-
-                p = pNext;
-                blocks = nextBlock;
-            }
-
-            int resultCode = 0;
-            uint32_t uncompressedSize = security->imageSize;
-            uint8_t* buffer = destData;
-
-            resultCode = lzxDecompress(compressBuffer.get(), d - compressBuffer.get(), buffer, uncompressedSize, ((const Xex2FileNormalCompressionInfo*)(fileFormatInfo + 1))->windowSize, nullptr, 0);
-
-            if (resultCode)
+            if ((verified.valid() && !verified.get()) || resultCode)
                 return {};
         }
     }
 
-    image.data = std::move(result);
+    if (imageData == nullptr)
+    {
+        image.data = std::move(result);
+        imageData = image.data.get();
+    }
+
     image.size = security->imageSize;
 
     // Map image
-    const auto* dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(image.data.get());
-    const auto* ntHeaders = reinterpret_cast<IMAGE_NT_HEADERS32*>(image.data.get() + dosHeader->e_lfanew);
+    const auto* dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(imageData);
+    const auto* ntHeaders = reinterpret_cast<IMAGE_NT_HEADERS32*>(imageData + dosHeader->e_lfanew);
 
     image.base = security->loadAddress;
     const void* xex2BaseAddressPtr = getOptHeaderPtr(data, XEX_HEADER_IMAGE_BASE_ADDRESS);
@@ -290,7 +320,7 @@ Image Xex2LoadImage(const uint8_t* data, size_t dataSize)
         }
 
         image.Map(reinterpret_cast<const char*>(section.Name), section.VirtualAddress, 
-            section.Misc.VirtualSize, flags, image.data.get() + section.VirtualAddress);
+            section.Misc.VirtualSize, flags, imageData + section.VirtualAddress);
     }
 
     auto* imports = reinterpret_cast<const Xex2ImportHeader*>(getOptHeaderPtr(data, XEX_HEADER_IMPORT_LIBRARIES));
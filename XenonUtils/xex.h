@@ -263,5 +263,11 @@ inline const void* getOptHeaderPtr(const uint8_t* moduleBytes, uint32_t headerKe
     return nullptr;
 }
 
+// Checks the hashes of a chain of compressed blocks, where every block starts with the size and the hash of the next one.
+bool Xex2VerifyCompressedBlocks(const uint8_t* data, size_t dataSize, const Xex2CompressedBlockInfo* blockInfo);
+
 struct Image;
-Image Xex2LoadImage(const uint8_t* data, size_t dataSize);
+struct MemoryMappedFile;
+
+// When the data is a copy-on-write mapping of the file, images stored uncompressed and unencrypted reference it instead of being copied.
+Image Xex2LoadImage(const uint8_t* data, size_t dataSize, bool verifyHashes = true, std::shared_ptr<MemoryMappedFile> file = {});
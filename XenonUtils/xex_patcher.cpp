@@ -15,14 +15,18 @@
 #include <bit>
 #include <cassert>
 #include <climits>
+#include <cstring>
 #include <fstream>
+#include <future>
+#include <thread>
 
 #include <aes.hpp>
 #include <lzx.h>
 #include <mspack.h>
-#include <TinySHA1.hpp>
 
+#include "aes_cbc.h"
 #include "memory_mapped_file.h"
+#include "sha1_hash.h"
 
 struct mspack_memory_file
 {
@@ -180,6 +184,122 @@ static int lzxDecompress(const void *lzxData, size_t lzxLength, void *dst, size_
     return resultCode;
 }
 
+// Reads the chunks of a chain of compressed blocks in place, with every block starting with the size and the
+// hash of the next one, followed by chunks prefixed with their big endian size and terminated by an empty one.
+struct mspack_block_file
+{
+    const uint8_t *dataEnd;
+    const uint8_t *block;
+    uint32_t blockSize;
+    const uint8_t *cursor;
+    const uint8_t *chunk;
+    size_t chunkRemaining;
+};
+
+// Returns false at the end of the chain, or when the chain is malformed, after which no more data is read.
+static bool mspack_block_next_chunk(mspack_block_file *blockFile)
+{
+    while (blockFile->blockSize != 0)
+    {
+        const uint8_t *blockEnd = blockFile->block + blockFile->blockSize;
+        if (blockFile->cursor + 2 > blockEnd)
+        {
+            break;
+        }
+
+        const size_t chunkSize = (blockFile->cursor[0] << 8) | blockFile->cursor[1];
+        blockFile->cursor += 2;
+
+        if (chunkSize != 0)
+        {
+            if (blockFile->cursor + chunkSize > blockEnd)
+            {
+                break;
+            }
+
+            blockFile->chunk = blockFile->cursor;
+            blockFile->chunkRemaining = chunkSize;
+            blockFile->cursor += chunkSize;
+            return true;
+        }
+
+        const Xex2CompressedBlockInfo *nextBlock = (const Xex2CompressedBlockInfo *)(blockFile->block);
+        blockFile->block = blockEnd;
+        blockFile->blockSize = nextBlock->blockSize;
+        blockFile->cursor = blockFile->block + sizeof(Xex2CompressedBlockInfo);
+
+        if (blockFile->blockSize != 0 && (blockFile->blockSize < sizeof(Xex2CompressedBlockInfo) || blockFile->blockSize > size_t(blockFile->dataEnd - blockFile->block)))
+        {
+            break;
+        }
+    }
+
+    blockFile->blockSize = 0;
+    return false;
+}
+
+static int mspack_block_read(mspack_file *file, void *buffer, int chars)
+{
+    mspack_block_file *blockFile = (mspack_block_file *)(file);
+    int total = 0;
+    while (total < chars)
+    {
+        if (blockFile->chunkRemaining == 0 && !mspack_block_next_chunk(blockFile))
+        {
+            break;
+        }
+
+        const size_t count = std::min(size_t(chars - total), blockFile->chunkRemaining);
+        std::memcpy((uint8_t *)(buffer) + total, blockFile->chunk, count);
+        blockFile->chunk += count;
+        blockFile->chunkRemaining -= count;
+        total += int(count);
+    }
+
+    return total;
+}
+
+int lzxDecompressBlocks(const uint8_t *blockData, size_t blockDataLength, uint32_t firstBlockSize, void *dst, size_t dstLength, uint32_t windowSize)
+{
+    int resultCode = 1;
+    uint32_t windowBits;
+    if (!bitScanForward(windowSize, &windowBits)) {
+        return resultCode;
+    }
+
+    if (firstBlockSize < sizeof(Xex2CompressedBlockInfo) || firstBlockSize > blockDataLength) {
+        return resultCode;
+    }
+
+    mspack_block_file lzxSrc = {};
+    lzxSrc.dataEnd = blockData + blockDataLength;
+    lzxSrc.block = blockData;
+    lzxSrc.blockSize = firstBlockSize;
+    lzxSrc.cursor = blockData + sizeof(Xex2CompressedBlockInfo);
+
+    mspack_system *sys = mspack_memory_sys_create();
+    mspack_memory_file *lzxDst = mspack_memory_open(sys, dst, dstLength);
+    if (sys) {
+        sys->read = mspack_block_read;
+    }
+
+    lzxd_stream *lzxd = lzxd_init(sys, (mspack_file *)(&lzxSrc), (mspack_file *)(lzxDst), windowBits, 0, 0x8000, dstLength, 0);
+    if (lzxd != nullptr) {
+        resultCode = lzxd_decompress(lzxd, dstLength);
+        lzxd_free(lzxd);
+    }
+
+    if (lzxDst) {
+        mspack_memory_close(lzxDst);
+    }
+
+    if (sys) {
+        mspack_memory_sys_destroy(sys);
+    }
+
+    return resultCode;
+}
+
 static int lzxDeltaApplyPatch(const Xex2DeltaPatch *deltaPatch, uint32_t patchLength, uint32_t windowSize, uint8_t *dstData)
 {
     const void *patchEnd = (const uint8_t *)(deltaPatch) + patchLength;
@@ -223,6 +343,15 @@ static int lzxDeltaApplyPatch(const Xex2DeltaPatch *deltaPatch, uint32_t patchLe
 }
 
 XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSize, const uint8_t* patchBytes, size_t patchBytesSize, std::vector<uint8_t> &outBytes, bool skipData)
+{
+    return apply(xexBytes, xexBytesSize, patchBytes, patchBytesSize, [&](size_t size)
+        {
+            outBytes.assign(size, 0);
+            return outBytes.data();
+        }, skipData);
+}
+
+XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSize, const uint8_t* patchBytes, size_t patchBytesSize, const std::function<uint8_t *(size_t)> &allocateOutput, bool skipData)
 {
     // Validate headers.
     static const char Xex2Magic[] = "XEX2";
@@ -289,35 +418,45 @@ XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSiz
         headerTargetSize = patchDescriptor->deltaHeadersTargetOffset + patchDescriptor->deltaHeadersSourceSize;
     }
 
-    // Create the bytes for the new XEX header. Copy over the existing data.
+    // Create the bytes for the new XEX header. Copy over the existing data. The size of the output is only known
+    // after patching the security info, so the header is patched in a separate buffer first.
     uint32_t newXexHeaderSize = std::max(headerTargetSize, xexHeader->headerSize.get());
-    outBytes.resize(newXexHeaderSize);
-    memset(outBytes.data(), 0, newXexHeaderSize);
-    memcpy(outBytes.data(), xexBytes, headerTargetSize);
+    std::vector<uint8_t> headerBytes(newXexHeaderSize);
+    memcpy(headerBytes.data(), xexBytes, std::min<size_t>(headerTargetSize, xexBytesSize));
 
-    Xex2Header *newXexHeader = (Xex2Header *)(outBytes.data());
     if (patchDescriptor->deltaHeadersSourceOffset > 0)
     {
-        memcpy(&outBytes[patchDescriptor->deltaHeadersTargetOffset], &outBytes[patchDescriptor->deltaHeadersSourceOffset], patchDescriptor->deltaHeadersSourceSize);
+        memcpy(&headerBytes[patchDescriptor->deltaHeadersTargetOffset], &headerBytes[patchDescriptor->deltaHeadersSourceOffset], patchDescriptor->deltaHeadersSourceSize);
     }
 
-    int resultCode = lzxDeltaApplyPatch(&patchDescriptor->info, patchDescriptor->size, ((const Xex2FileNormalCompressionInfo*)(patchFileFormatInfo + 1))->windowSize, outBytes.data());
+    int resultCode = lzxDeltaApplyPatch(&patchDescriptor->info, patchDescriptor->size, ((const Xex2FileNormalCompressionInfo*)(patchFileFormatInfo + 1))->windowSize, headerBytes.data());
     if (resultCode != 0)
     {
         return Result::PatchFailed;
     }
 
-    // Make the header the specified size by the patch.
-    outBytes.resize(headerTargetSize);
-    newXexHeader = (Xex2Header *)(outBytes.data());
+    const Xex2Header *newXexHeader = (const Xex2Header *)(headerBytes.data());
+    if (newXexHeader->securityOffset > headerTargetSize || sizeof(Xex2SecurityInfo) > headerTargetSize - newXexHeader->securityOffset)
+    {
+        return Result::PatchFailed;
+    }
 
-    // Copy the rest of the data.
-    const Xex2SecurityInfo *newSecurityInfo = (const Xex2SecurityInfo *)(&outBytes[newXexHeader->securityOffset]);
-    outBytes.resize(outBytes.size() + newSecurityInfo->imageSize);
-    memset(&outBytes[headerTargetSize], 0, outBytes.size() - headerTargetSize);
-    memcpy(&outBytes[headerTargetSize], &xexBytes[xexHeader->headerSize], xexBytesSize - xexHeader->headerSize);
-    newXexHeader = (Xex2Header *)(outBytes.data());
+    // Allocate the output once with the header the size specified by the patch, followed by the image.
+    const Xex2SecurityInfo *newSecurityInfo = (const Xex2SecurityInfo *)(&headerBytes[newXexHeader->securityOffset]);
+    const size_t outImageSize = newSecurityInfo->imageSize;
+    uint8_t *outBytes = allocateOutput(headerTargetSize + outImageSize);
+    if (outBytes == nullptr)
+    {
+        return Result::FileWriteFailed;
+    }
+
+    memcpy(outBytes, headerBytes.data(), headerTargetSize);
+    newXexHeader = (const Xex2Header *)(outBytes);
     newSecurityInfo = (const Xex2SecurityInfo *)(&outBytes[newXexHeader->securityOffset]);
+
+    uint8_t *outImage = &outBytes[headerTargetSize];
+    const uint8_t *exeBytes = &xexBytes[xexHeader->headerSize];
+    const size_t exeLength = xexBytesSize - xexHeader->headerSize;
     
     // Decrypt the keys and validate that the patch is compatible with the base file.
     constexpr uint32_t KeySize = 16;
@@ -351,29 +490,34 @@ XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSiz
         return Result::PatchIncompatible;
     }
 
-    // Don't process the rest of the patch.
+    // Don't process the rest of the patch, and leave the base data as is.
     if (skipData)
     {
+        memcpy(outImage, exeBytes, std::min(exeLength, outImageSize));
         return Result::Success;
     }
     
-    // Decrypt base XEX if necessary.
+    // Decrypt base XEX if necessary. The data is decrypted or copied straight into the image, apart from
+    // compressed blocks, which are read where they are when possible.
     const Xex2OptFileFormatInfo *fileFormatInfo = (const Xex2OptFileFormatInfo *)(getOptHeaderPtr(xexBytes, XEX_HEADER_FILE_FORMAT_INFO));
     if (fileFormatInfo == nullptr)
     {
         return Result::XexFileInvalid;
     }
 
-    if (fileFormatInfo->encryptionType == XEX_ENCRYPTION_NORMAL)
-    {
-        AES_init_ctx_iv(&aesContext, decryptedOriginalKey, AESBlankIV);
-        AES_CBC_decrypt_buffer(&aesContext, &outBytes[headerTargetSize], xexBytesSize - xexHeader->headerSize);
-    }
-    else if (fileFormatInfo->encryptionType != XEX_ENCRYPTION_NONE)
+    if (fileFormatInfo->encryptionType != XEX_ENCRYPTION_NORMAL && fileFormatInfo->encryptionType != XEX_ENCRYPTION_NONE)
     {
         return Result::XexFileInvalid;
     }
 
+    auto readBaseData = [&](uint8_t *dst, size_t size)
+        {
+            if (fileFormatInfo->encryptionType == XEX_ENCRYPTION_NORMAL)
+                AesCbcDecrypt(decryptedOriginalKey, AESBlankIV, exeBytes, dst, size, std::thread::hardware_concurrency());
+            else
+                memcpy(dst, exeBytes, size);
+        };
+
     // Decompress base XEX if necessary.
     if (fileFormatInfo->compressionType == XEX_COMPRESSION_BASIC)
     {
@@ -386,14 +530,16 @@ XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSiz
             baseImageSize += blocks[i].dataSize + blocks[i].zeroSize;
         }
 
-        if (outBytes.size() < (headerTargetSize + baseImageSize))
+        if (outImageSize < size_t(baseImageSize) || exeLength < size_t(baseCompressedSize))
         {
             return Result::XexFileInvalid;
         }
+
+        readBaseData(outImage, std::min(exeLength, outImageSize));
         
         // Reverse iteration allows to perform this decompression in place.
-        uint8_t *srcDataCursor = outBytes.data() + headerTargetSize + baseCompressedSize;
-        uint8_t *outDataCursor = outBytes.data() + headerTargetSize + baseImageSize;
+        uint8_t *srcDataCursor = outImage + baseCompressedSize;
+        uint8_t *outDataCursor = outImage + baseImageSize;
         for (int32_t i = numBlocks - 1; i >= 0; i--)
         {
             outDataCursor -= blocks[i].zeroSize;
@@ -405,70 +551,40 @@ XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSiz
     }
     else if (fileFormatInfo->compressionType == XEX_COMPRESSION_NORMAL)
     {
-        const Xex2CompressedBlockInfo* blocks = &((const Xex2FileNormalCompressionInfo*)(fileFormatInfo + 1))->firstBlock;
-        const uint32_t exeLength = xexBytesSize - xexHeader->headerSize.get();
-        const uint8_t* exeBuffer = &outBytes[headerTargetSize];
-
-        auto compressBuffer = std::make_unique<uint8_t[]>(exeLength);
-        const uint8_t* p = NULL;
-        uint8_t* d = NULL;
-        sha1::SHA1 s;
-
-        p = exeBuffer;
-        d = compressBuffer.get();
+        const Xex2FileNormalCompressionInfo *compressionInfo = (const Xex2FileNormalCompressionInfo *)(fileFormatInfo + 1);
 
-        uint8_t blockCalcedDigest[0x14];
-        while (blocks->blockSize) 
+        // Compressed blocks are decompressed straight into the image, so they only need a separate buffer when decrypted.
+        std::unique_ptr<uint8_t[]> decryptedExe;
+        const uint8_t *compressedData = exeBytes;
+        if (fileFormatInfo->encryptionType == XEX_ENCRYPTION_NORMAL)
         {
-            const uint8_t* pNext = p + blocks->blockSize;
-            const auto* nextBlock = (const Xex2CompressedBlockInfo*)p;
-
-            s.reset();
-            s.processBytes(p, blocks->blockSize);
-            s.finalize(blockCalcedDigest);
-
-            if (memcmp(blockCalcedDigest, blocks->blockHash, 0x14) != 0)
-                return Result::PatchFailed;
-
-            p += 4;
-            p += 20;
-
-            while (true) 
-            {
-                const size_t chunkSize = (p[0] << 8) | p[1];
-                p += 2;
-
-                if (!chunkSize)
-                    break;
-
-                memcpy(d, p, chunkSize);
-                p += chunkSize;
-                d += chunkSize;
-            }
-
-            p = pNext;
-            blocks = nextBlock;
+            decryptedExe = std::make_unique<uint8_t[]>(exeLength);
+            readBaseData(decryptedExe.get(), exeLength);
+            compressedData = decryptedExe.get();
         }
 
-        int resultCode = 0;
-        uint32_t uncompressedSize = originalSecurityInfo->imageSize;
-        uint8_t* buffer = outBytes.data() + newXexHeaderSize;
+        auto verified = std::async(std::launch::async, Xex2VerifyCompressedBlocks, compressedData, exeLength, &compressionInfo->firstBlock);
 
-        resultCode = lzxDecompress(compressBuffer.get(), d - compressBuffer.get(), buffer, uncompressedSize, ((const Xex2FileNormalCompressionInfo*)(fileFormatInfo + 1))->windowSize, nullptr, 0);
+        size_t uncompressedSize = std::min<size_t>(originalSecurityInfo->imageSize, outImageSize);
+        resultCode = lzxDecompressBlocks(compressedData, exeLength, compressionInfo->firstBlock.blockSize, outImage, uncompressedSize, compressionInfo->windowSize);
 
-        if (resultCode)
+        if (!verified.get() || resultCode)
             return Result::PatchFailed;
     }
     else if (fileFormatInfo->compressionType == XEX_COMPRESSION_DELTA)
     {
         return Result::XexFileUnsupported;
     }
-    else if (fileFormatInfo->compressionType != XEX_COMPRESSION_NONE)
+    else if (fileFormatInfo->compressionType == XEX_COMPRESSION_NONE)
+    {
+        readBaseData(outImage, std::min(exeLength, outImageSize));
+    }
+    else
     {
         return Result::XexFileInvalid;
     }
 
-    Xex2OptFileFormatInfo *newFileFormatInfo = (Xex2OptFileFormatInfo *)(getOptHeaderPtr(outBytes.data(), XEX_HEADER_FILE_FORMAT_INFO));
+    Xex2OptFileFormatInfo *newFileFormatInfo = (Xex2OptFileFormatInfo *)(getOptHeaderPtr(outBytes, XEX_HEADER_FILE_FORMAT_INFO));
     if (newFileFormatInfo == nullptr)
     {
         return Result::PatchFailed;
@@ -478,22 +594,34 @@ XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSiz
     newFileFormatInfo->encryptionType = XEX_ENCRYPTION_NONE;
     newFileFormatInfo->compressionType = XEX_COMPRESSION_NONE;
 
-    // Copy and decrypt patch data if necessary.
-    std::vector<uint8_t> patchData;
-    patchData.resize(patchBytesSize - patchHeader->headerSize);
-    memcpy(patchData.data(), &patchBytes[patchHeader->headerSize], patchData.size());
+    // Stream the patch data one block at a time. CBC decryption of a block only depends on the ciphertext
+    // block before it, so every patch block is decrypted on its own, and used in place when not encrypted.
+    const uint8_t *patchData = &patchBytes[patchHeader->headerSize];
+    const size_t patchDataSize = patchBytesSize - patchHeader->headerSize;
 
-    if (patchFileFormatInfo->encryptionType == XEX_ENCRYPTION_NORMAL)
-    {
-        AES_init_ctx_iv(&aesContext, decryptedPatchKey, AESBlankIV);
-        AES_CBC_decrypt_buffer(&aesContext, patchData.data(), patchData.size());
-    }
-    else if (patchFileFormatInfo->encryptionType != XEX_ENCRYPTION_NONE)
+    if (patchFileFormatInfo->encryptionType != XEX_ENCRYPTION_NORMAL && patchFileFormatInfo->encryptionType != XEX_ENCRYPTION_NONE)
     {
         return Result::PatchFileInvalid;
     }
 
-    const Xex2CompressedBlockInfo *currentBlock = &((const Xex2FileNormalCompressionInfo*)(patchFileFormatInfo + 1))->firstBlock;
+    std::vector<uint8_t> patchBlockBytes;
+    auto readPatchBlock = [&](size_t offset, size_t size)
+        {
+            if (patchFileFormatInfo->encryptionType == XEX_ENCRYPTION_NONE)
+                return &patchData[offset];
+
+            constexpr size_t AesBlockSize = 16;
+            size_t begin = offset & ~(AesBlockSize - 1);
+            size_t end = std::min((offset + size + AesBlockSize - 1) & ~(AesBlockSize - 1), patchDataSize);
+            const uint8_t *iv = begin == 0 ? AESBlankIV : &patchData[begin - AesBlockSize];
+
+            patchBlockBytes.resize(end - begin);
+            AesCbcDecrypt(decryptedPatchKey, iv, &patchData[begin], patchBlockBytes.data(), end - begin);
+            return (const uint8_t *)(&patchBlockBytes[offset - begin]);
+        };
+
+    // Hashes are chained through the blocks, so the info of the next block is copied before the buffer is reused.
+    Xex2CompressedBlockInfo currentBlock = ((const Xex2FileNormalCompressionInfo*)(patchFileFormatInfo + 1))->firstBlock;
     uint8_t *outExe = &outBytes[newXexHeader->headerSize];
     if (patchDescriptor->deltaImageSourceOffset > 0)
     {
@@ -502,31 +630,32 @@ XexPatcher::Result XexPatcher::apply(const uint8_t* xexBytes, size_t xexBytesSiz
 
     static const uint32_t DigestSize = 20;
     uint8_t sha1Digest[DigestSize];
-    sha1::SHA1 sha1Context;
-    uint8_t *patchDataCursor = patchData.data();
-    while (currentBlock->blockSize > 0)
+    size_t patchDataOffset = 0;
+    while (currentBlock.blockSize > 0)
     {
-        const Xex2CompressedBlockInfo *nextBlock = (const Xex2CompressedBlockInfo *)(patchDataCursor);
+        if (currentBlock.blockSize < sizeof(Xex2CompressedBlockInfo) || currentBlock.blockSize > patchDataSize - patchDataOffset)
+        {
+            return Result::PatchFailed;
+        }
+
+        const uint8_t *patchBlock = readPatchBlock(patchDataOffset, currentBlock.blockSize);
+        const Xex2CompressedBlockInfo nextBlock = *(const Xex2CompressedBlockInfo *)(patchBlock);
 
         // Hash and validate the block.
-        sha1Context.reset();
-        sha1Context.processBytes(patchDataCursor, currentBlock->blockSize);
-        sha1Context.finalize(sha1Digest);
-        if (memcmp(sha1Digest, currentBlock->blockHash, DigestSize) != 0)
+        Sha1Hash(patchBlock, currentBlock.blockSize, sha1Digest);
+        if (memcmp(sha1Digest, currentBlock.blockHash, DigestSize) != 0)
         {
             return Result::PatchFailed;
         }
 
-        patchDataCursor += 24;
-
         // Apply the block's patch data.
-        uint32_t blockDataSize = currentBlock->blockSize - 24;
-        if (lzxDeltaApplyPatch((const Xex2DeltaPatch *)(patchDataCursor), blockDataSize, ((const Xex2FileNormalCompressionInfo*)(patchFileFormatInfo + 1))->windowSize, outExe) != 0)
+        uint32_t blockDataSize = currentBlock.blockSize - 24;
+        if (lzxDeltaApplyPatch((const Xex2DeltaPatch *)(patchBlock + 24), blockDataSize, ((const Xex2FileNormalCompressionInfo*)(patchFileFormatInfo + 1))->windowSize, outExe) != 0)
         {
             return Result::PatchFailed;
         }
 
-        patchDataCursor += blockDataSize;
+        patchDataOffset += currentBlock.blockSize;
         currentBlock = nextBlock;
     }
 
@@ -542,27 +671,30 @@ XexPatcher::Result XexPatcher::apply(const std::filesystem::path &baseXexPath, c
         return Result::FileOpenFailed;
     }
 
-    std::vector<uint8_t> newXexBytes;
-    Result result = apply(baseXexFile.data(), baseXexFile.size(), patchFile.data(), patchFile.size(), newXexBytes, false);
-    if (result != Result::Success)
-    {
-        return result;
-    }
+    // The new XEX is patched directly into a mapping of a file created next to the output once its size is known.
+    // It only replaces the output after a successful patch, so an interrupted run never leaves a partial XEX behind.
+    std::filesystem::path tempXexPath = newXexPath;
+    tempXexPath += ".tmp";
 
-    std::ofstream newXexFile(newXexPath, std::ios::binary);
-    if (!newXexFile.is_open())
-    {
-        return Result::FileOpenFailed;
-    }
+    MemoryMappedFile newXexFile;
+    Result result = apply(baseXexFile.data(), baseXexFile.size(), patchFile.data(), patchFile.size(), [&](size_t size)
+        {
+            return newXexFile.create(tempXexPath, size) ? newXexFile.data() : nullptr;
+        }, false);
 
-    newXexFile.write((const char *)(newXexBytes.data()), newXexBytes.size());
     newXexFile.close();
 
-    if (newXexFile.bad())
+    std::error_code ec;
+    if (result == Result::Success)
     {
-        std::filesystem::remove(newXexPath);
-        return Result::FileWriteFailed;
+        std::filesystem::rename(tempXexPath, newXexPath, ec);
+        if (!ec)
+            return Result::Success;
+
+        result = Result::FileWriteFailed;
     }
 
-    return Result::Success;
+    std::filesystem::remove(tempXexPath, ec);
+
+    return result;
 }
@@ -13,11 +13,15 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <span>
 #include <vector>
 
 extern int lzxDecompress(const void* lzxData, size_t lzxLength, void* dst, size_t dstLength, uint32_t windowSize, void* windowData, size_t windowDataLength);
 
+// Decompresses the chunks of an XEX_COMPRESSION_NORMAL image directly from its chain of blocks, without verifying their hashes.
+extern int lzxDecompressBlocks(const uint8_t* blockData, size_t blockDataLength, uint32_t firstBlockSize, void* dst, size_t dstLength, uint32_t windowSize);
+
 struct XexPatcher
 {
     enum class Result {
@@ -33,5 +37,8 @@ struct XexPatcher
     };
 
     static Result apply(const uint8_t* xexBytes, size_t xexBytesSize, const uint8_t* patchBytes, size_t patchBytesSize, std::vector<uint8_t> &outBytes, bool skipData);
+
+    // Patches into memory returned by the callback, which is called once with the final size of the new XEX and must return zero-filled memory, or null on failure.
+    static Result apply(const uint8_t* xexBytes, size_t xexBytesSize, const uint8_t* patchBytes, size_t patchBytesSize, const std::function<uint8_t *(size_t)> &allocateOutput, bool skipData);
     static Result apply(const std::filesystem::path &baseXexPath, const std::filesystem::path &patchXexPath, const std::filesystem::path &newXexPath);
 };
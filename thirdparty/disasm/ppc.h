@@ -36,3 +36,4 @@
 #define PPC_OP_SC 0x11
 #define PPC_OP_B 0x12
 #define PPC_OP_CTR 0x13
+#define PPC_OP_ORI 0x18